@@ -21,6 +21,10 @@
 
 #include "common.h"
 
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
 
 constexpr uint64_t FILE_A = 0x0101010101010101;
 constexpr uint64_t FILE_B = 0x0202020202020202;
@@ -129,22 +133,157 @@ constexpr int NUM_BISHOP_BITS[64] = {
     6, 5, 5, 5, 5, 5, 5, 6
 };
 
+// Magic numbers for the relevant occupancy masks below, used when PEXT is not
+// available. They were found by trial and error with a seeded xorshift
+// generator, following Tord Romstad's approach:
+// https://chessprogramming.wikispaces.com/Looking+for+Magics
+constexpr uint64_t BISHOP_MAGICS[64] = {
+0x3e40902222004210, 0x38a0414c00a08000, 0x3490044088280602, 0x1604070200900202,
+0x3d82021100100000, 0x2e81100290010100, 0x7f82020120084202, 0x6a81008041084020,
+0x3a80046002242100, 0x3b01908491004200, 0x3f00b02506082420, 0x2b82280481100001,
+0x3780040504002403, 0x1588008821080808, 0x16b0040098041100, 0x3900402202300400,
+0x5611032004411800, 0x3708132001014e06, 0x3d8802c040802080, 0x3790801802024210,
+0x3ea2004420210480, 0x3738400200622000, 0x3f8100228a88a005, 0x1b02004242221100,
+0x3e90040210459010, 0x5fc12020100ab606, 0x1f70501031040280, 0x6ba0080001004008,
+0x2ea10100d4104002, 0x1f1001020080a088, 0x2f90a40005010881, 0x3981110102124504,
+0x2f94244004a08300, 0x1781115080889000, 0x3fc2080202040020, 0x3f80400808048201,
+0x6340010012010040, 0x3e208b03024a008a, 0x2588122040040140, 0x41b080808d020220,
+0x178aa8541045c004, 0x3a94008824100980, 0x0f900a0090010200, 0x3d80004010400208,
+0x7580941810140601, 0x3f84011002081102, 0x66052428004d0604, 0x2f8810812a041040,
+0x3680521004200000, 0x5b80484404200208, 0x3790002208120800, 0x3ec0404104a80308,
+0x1b801090a0221100, 0x3388400224410400, 0x2ba0a06220812000, 0x3d90440088820820,
+0x6f86022118082400, 0x5ba0024c02080288, 0x3f80040842024110, 0x26c0000002104420,
+0x3f90100040104110, 0x7e00004212141508, 0x1880a060c2024040, 0x3782021014010446
+};
+
+constexpr uint64_t ROOK_MAGICS[64] = {
+0x2880024000221880, 0x3b80102001400484, 0x1f80082002801001, 0x1f80080110008580,
+0x7d80022400804801, 0x3e80020080014400, 0x3880408002000100, 0x2e0000802c090042,
+0x3d08800c80400024, 0x3dc2804000200080, 0x3e8a002208401080, 0x3d20040042010080,
+0x5b80800800040080, 0x3f02808012001400, 0x1f88804200010080, 0x1f01000200b04100,
+0x3780004000200040, 0x3b90004040002001, 0x6150010100402000, 0x3f88010100201000,
+0x3bc4110004080101, 0x7880808004000200, 0x1388040002880150, 0x33a026000a40a104,
+0x3fa0400080002084, 0x0e00200640045000, 0x3600200100410010, 0x0780100080080080,
+0x6f80080080800400, 0x2540020080800400, 0x7f81000100020004, 0x3fa0008200010044,
+0x2e80002000400040, 0x7c80200486804004, 0x17b0801000802001, 0x23c0801000800802,
+0x3790040080800800, 0x1e82000802001004, 0x6ec1000401000200, 0x323880a042000104,
+0x1980804000208000, 0x2f81008040050020, 0x33900080200c8010, 0x1a98018010048008,
+0x0784000800808004, 0x1382008004008002, 0x7c90010002008080, 0x7b80008100420024,
+0x1780024002200240, 0x1d80804000201880, 0x2f860020401a8200, 0x3a88220040081200,
+0x3f03020800100500, 0x3b08800200040080, 0x52a0082291100400, 0x3602004924088200,
+0x0500201100800041, 0x3f82130480400021, 0x6fc600d081292042, 0x3091041000082101,
+0x1f82000410200802, 0x3b02000815902c06, 0x77c2811090022814, 0x3f8c082408810042
+};
+
+// The squares a slider on (file, rank) attacks moving in the direction
+// (df, dr), up to and including the first occupied square
+constexpr uint64_t rayAttacks(int file, int rank, int df, int dr, uint64_t occ) {
+    return (file + df < 0 || file + df > 7 || rank + dr < 0 || rank + dr > 7) ? 0
+         : (occ & indexToBit(8 * (rank + dr) + file + df)) ? indexToBit(8 * (rank + dr) + file + df)
+         : indexToBit(8 * (rank + dr) + file + df) | rayAttacks(file + df, rank + dr, df, dr, occ);
+}
+
+// Slow rook and bishop attacks, only used to build the constant tables
+constexpr uint64_t rookRays(int sq, uint64_t occ) {
+    return rayAttacks(sq & 7, sq >> 3, 0, 1, occ) | rayAttacks(sq & 7, sq >> 3, 0, -1, occ)
+         | rayAttacks(sq & 7, sq >> 3, 1, 0, occ) | rayAttacks(sq & 7, sq >> 3, -1, 0, occ);
+}
+
+constexpr uint64_t bishopRays(int sq, uint64_t occ) {
+    return rayAttacks(sq & 7, sq >> 3, 1, 1, occ) | rayAttacks(sq & 7, sq >> 3, -1, 1, occ)
+         | rayAttacks(sq & 7, sq >> 3, 1, -1, occ) | rayAttacks(sq & 7, sq >> 3, -1, -1, occ);
+}
+
+// The relevant occupancy bits are everything except the edges, but we don't
+// want to remove the edge that we are on
+constexpr uint64_t relevantSqs(int sq) {
+    return ((~FILE_A & ~FILE_H) | FILES[sq & 7]) & ((~RANK_1 & ~RANK_8) | RANKS[sq >> 3]);
+}
+
+// The masks are rook and bishop attacks on an empty board
+constexpr uint64_t rookMask(int sq) {
+    return rookRays(sq, 0) & relevantSqs(sq);
+}
+
+constexpr uint64_t bishopMask(int sq) {
+    return bishopRays(sq, 0) & relevantSqs(sq);
+}
+
+// Maps an index from 0 to 2^n - 1 onto the n bits of mask, in order from the
+// lowest bit (the inverse of PEXT)
+constexpr uint64_t depositBits(uint64_t index, uint64_t mask) {
+    return (mask == 0) ? 0
+         : ((index & 1) ? (mask & (0 - mask)) : 0) | depositBits(index >> 1, mask & (mask - 1));
+}
+
+// All squares in a line strictly between sq1 and sq2, or none if the squares
+// are not on a line
+constexpr uint64_t inBetween(int sq1, int sq2) {
+    return (rookRays(sq1, indexToBit(sq2)) & indexToBit(sq2))
+             ? rookRays(sq1, indexToBit(sq2)) & rookRays(sq2, indexToBit(sq1))
+         : (bishopRays(sq1, indexToBit(sq2)) & indexToBit(sq2))
+             ? bishopRays(sq1, indexToBit(sq2)) & bishopRays(sq2, indexToBit(sq1))
+         : 0;
+}
+
+template <class Indices> struct InBetweenTable;
+template <int... Is> struct InBetweenTable<IndexList<Is...>> {
+    static constexpr uint64_t sqs[64][64] = {inBetween(Is / 64, Is % 64)...};
+};
+template <int... Is> constexpr uint64_t InBetweenTable<IndexList<Is...>>::sqs[64][64];
+
+// Lookup table for all squares in a line between the from and to squares
+static constexpr const uint64_t (&inBetweenSqs)[64][64] = InBetweenTable<MakeIndexList<64 * 64>::type>::sqs;
+
 /**
  * @brief Stores the 4 values necessary to get a magic ray attack from a
  * specific square
  * @var table A pointer to the start of the array of attack sets for this square
  * @var mask The mask of relevant occupancy bits for this square
- * @var magic The magic 64-bit integer that maps the mask to the array index
+ * @var magic The magic 64-bit integer that maps the mask to the array index,
+ * unused when the table is indexed with PEXT
  * @var shift The amount to shift by after multiplying mask by magic
  */
 struct MagicInfo {
-    uint64_t *table;
+    const uint64_t *table;
     uint64_t mask;
     uint64_t magic;
     int shift;
 };
 
-void initMagicTables(uint64_t seed);
-void initInBetweenTable();
+// Set at startup when the CPU has a fast BMI2 implementation. The attack tables
+// are then indexed by extracting the relevant occupancy bits with PEXT instead
+// of by magic multiplication.
+extern bool usePext;
+
+// Builds with AVX2_ATTACKS=true can compute the slider attack sets for the
+// evaluation with vectorized fills, four pieces per register. This is off by
+// default since it is slower than the table lookups on the CPUs we tested.
+#if defined(AVX2_ATTACKS) && defined(__x86_64__) && defined(__GNUC__)
+#define HAS_AVX2_ATTACKS
+#endif
+
+// Set at startup in AVX2_ATTACKS builds when the CPU supports AVX2
+extern bool useAvx2;
+
+// Parallel bit extract, only valid when usePext is set. Without -mbmi2 the
+// instruction is emitted through inline assembly, so that a generic build can
+// still inline it.
+inline uint64_t pext(uint64_t src, uint64_t mask) {
+#if defined(__BMI2__)
+    return _pext_u64(src, mask);
+#elif defined(__x86_64__) && defined(__GNUC__)
+    uint64_t result;
+    __asm__("pextq %2, %1, %0" : "=r" (result) : "r" (src), "r" (mask));
+    return result;
+#else
+    (void) src;
+    (void) mask;
+    return 0;
+#endif
+}
+
+void initCpuFeatures();
+void initMagicTables();
 
 #endif
@@ -18,10 +18,12 @@
 
 #include <algorithm>
 #include <cstring>
-#include <random>
 #include <string>
 #include "board.h"
 #include "bbinit.h"
+#ifdef HAS_AVX2_ATTACKS
+#include <immintrin.h>
+#endif
 #include "eval.h"
 #include "uci.h"
 
@@ -31,30 +33,249 @@ constexpr uint64_t WHITE_QSIDE_PASSTHROUGH_SQS = indexToBit(1) | indexToBit(2) |
 constexpr uint64_t BLACK_KSIDE_PASSTHROUGH_SQS = indexToBit(61) | indexToBit(62);
 constexpr uint64_t BLACK_QSIDE_PASSTHROUGH_SQS = indexToBit(57) | indexToBit(58) | indexToBit(59);
 
-// Zobrist hashing table and the start position key, both initialized at startup
-uint64_t zobristTable[794];
+// Zobrist hashing table: 384 keys for each color's pieces on each square, then
+// one key for side to move, 16 for castling rights, and 9 for en passant files.
+// The keys are the first 794 outputs of std::mt19937_64 seeded with
+// 61280152908, so that saved hash files from older versions stay valid.
+extern const uint64_t zobristTable[794] = {
+    0x31aa046f8dceb433, 0xc1aba8571552ae99, 0xc9aa657d390f33bb, 0x562e94df82388ed6,
+    0xf9ae8af461f75526, 0xd9a48568631b48a0, 0x2747f3e41fd415e7, 0x16f510da4f366fc4,
+    0xbb3b80dd7d5d7c2f, 0xe6a7cbdd73467b87, 0xe99351c7780cf194, 0x98ae897eb44ccd5d,
+    0xba7cdbb541a668d7, 0x258bae5835ac092e, 0x73de9ed7b08e8d12, 0x0a7b3c389621491c,
+    0x15ced2972e136ced, 0xe7f67e065c5a1b86, 0x192b68e6b457cc5e, 0x7fd494e77db447b9,
+    0x3d1edbf8010457ca, 0xb4a000b03aa42d2c, 0xc27ffa3efa5fc768, 0x88f0e8ad1d979e01,
+    0x14207b71f4a7d85f, 0x02d1b4d0278a78c2, 0xae50819928225507, 0xecdb31a78e54e38f,
+    0xca21b69608bfe7b1, 0xde5de22eb717e84f, 0xb203f1f135e45b78, 0xb4bf4d09d61f680e,
+    0x7b04872b2bb3b8a5, 0x8c3de4099ef7a6d8, 0x5859f1cbb8cfa1b6, 0x504951fe2702aa19,
+    0xd82cab5fb441b7ea, 0x44f6bf68ab05cd14, 0x414097c2ca335bf7, 0x69aba7f9de276c52,
+    0x6e4c3eb8be44aa29, 0x9290eb80834e5e72, 0x800a6d34352700aa, 0xa6ca3061eef15a06,
+    0x8ace057235b10ddc, 0xcf213a4930aa4503, 0x5faeccd143545939, 0x4d097a6873e77d6e,
+    0x9e06565f570c874f, 0xcfb4689d8157cdc2, 0x237ad1b0edd6271a, 0xfb7a28ee29c4d6c0,
+    0x08191a22b15dcf0c, 0x6f444b4d940d0b05, 0xaff47193ae4e5bf1, 0xc1e50879568eb2cf,
+    0xb9647f5b04efa3b7, 0x76e2ce111f2ca5af, 0x0341b93430407061, 0xe16c7e7d6c99b897,
+    0x2b68c276c28d2921, 0xe50332f8cf1be2ee, 0x6e0b52a2753f53c0, 0xb0499849aeac62ab,
+    0x35b4d269f15a7d1c, 0xd8354c0292eb03fd, 0xf9de9cdf951825e7, 0x5a43dd0b8d388370,
+    0x727171353ac9b8f9, 0x4f1f85d1a0d586cf, 0x34372e911eee7fe9, 0xe5ed1f08f4fe3219,
+    0x47f3d3cb06c4df1b, 0x464adb82aec4d9c2, 0xfe51debb1206ee09, 0x4f6dd7547cfdc997,
+    0x009c055b8fd2ccf5, 0x21c48cc6662e3ad7, 0xe9b8603192d94f76, 0x31c25f2f49ca091d,
+    0x42863fdf8501c933, 0x65dc65b9fa80d94e, 0x0e59da21ac9da005, 0x9cb8f709ca98f705,
+    0x4c59670f00dcafb1, 0x7dbfe14598d33011, 0xc3bc8ffddcb8d8fd, 0x9f628601191f6eb1,
+    0x8abc0002a1bdac7b, 0x5e580786437f52e0, 0x496526ea5d8aea22, 0x4ce32e70abb7af93,
+    0xe84c62a9fff91612, 0x56a6a86be765ca19, 0x0501c89d3950ead7, 0xa16e2da56228aa8c,
+    0x3913741bed9e82d4, 0x5aad7785be132d0d, 0x4436e7b1faf768d2, 0xeb57fe4a24bfcdac,
+    0x96d44f94e9d129b5, 0x22932563abb3a213, 0xddb0790ced085e94, 0xa6db36bd1883d7a5,
+    0x2b8491173f14661b, 0xe8af233f48972194, 0xa22662f83965893f, 0x643d9a8fdfdb015a,
+    0x0195e903f4406537, 0x10ae6ecccba136ee, 0xaf7a923389907efa, 0xa3f72abfd82fdc8a,
+    0xffc4c4b3594fe15b, 0xce41c51e398a25b9, 0xd7b425764816303e, 0xb9a13795b7029a50,
+    0xb8390438b065b07e, 0x16644abaa39b2238, 0x3214875fe1ff75a2, 0xcdd1d9118b644fab,
+    0x16f153baddf84716, 0x6f15eb746b9e0036, 0x0bd8a8dcb270b63d, 0xd4e7aa78ef35e599,
+    0xca4de05806a92c8b, 0x0fcad94f6f8a03ca, 0xe906e2aeafb8de18, 0xc6e585b71f69bd9c,
+    0x8190ffa0b3e25939, 0xa732ab460e2df7b9, 0xf36f1ba6f6d1a953, 0xac21e91463c298ad,
+    0xb7c53afcc7785e62, 0xa385445e0567c34b, 0x4f8ef83121376c51, 0xaae3cca990cae691,
+    0xc56b8a7b667b931e, 0x6deb73207bba58c7, 0x8f315a93b8c01eed, 0x06586c1e4ddae173,
+    0xcd259edcce5aeb3f, 0x13d5deffccdb6d12, 0x5b9702ca05c797aa, 0x362909adea38b02b,
+    0xebd65cde99dabb6d, 0xa7aec594273aaecb, 0x0bf1dc4f5521eab4, 0x2c8484449346a68b,
+    0x91b1a86463f3b1e1, 0x890e15e7059bafe6, 0xe87b13d981e6f114, 0x38aab5bd75bbb4ae,
+    0x58f0cfd66b78fb7d, 0x6bfc26b8706db126, 0x54c14260650cbff8, 0x6bc09ff63d6c7d2c,
+    0x02458088d7ab45b6, 0x0ff2c6bdeb6e7350, 0xeb60e02f0c22e6df, 0x1d09f81135cc7004,
+    0x73ba18c1dc045024, 0x1b7b8aac5cb7a08f, 0x18645fb72da360dc, 0x83d6f55f2df4713f,
+    0x410fc2e92ff4e69e, 0x52666071f2a607b6, 0xcae9280d5cec54a8, 0x32393bb1ae477c1b,
+    0xdcbf30d08a88b4a9, 0x2413d29121794de4, 0x63ccadc36c5a96d5, 0xcf507b6c6a78f61f,
+    0xfa44371e891d32e4, 0x3d5b7dae4bf91974, 0xb92418f0149ed168, 0xc529bff95c481f8b,
+    0xd6b9655d9a0260fa, 0x31af473b1b6c8669, 0xbe1b93b024c6f953, 0xb2da56fa1498c45b,
+    0x347432cdb1cd2509, 0xac6f54990a992f7a, 0x940231a5974a32b1, 0x064373e17061a4e6,
+    0xc14f71dc20aadb6a, 0x09d9c38104472408, 0x85fb9a539474fdbf, 0x833f45e306251dab,
+    0x365d0bb6ae12ea32, 0x139d0fef772414e5, 0x8b75b21283e50d85, 0x3d405c66c5f63387,
+    0xbd166b83074a6fe4, 0xa4e82a4d2063dc2f, 0x0b60a91755972059, 0x35e42c034a22d9f6,
+    0x73e38f2788527199, 0x64ccd8a15d2dec57, 0x307f536503f6222d, 0xf3073a823f6d9ee2,
+    0xe7ada821612812f9, 0xc7dbc428cde99837, 0x8757715c8f9c845d, 0x845348b296ec3454,
+    0xdaf2021c6809930f, 0x1991bc3411d5fb67, 0xab336a3d83ca0c55, 0xb4270ef9e0c7ffa9,
+    0xf242468e21f3089b, 0x1481cd289d2a9b18, 0x96addcaab28e3c67, 0xf1c5bb09eef27505,
+    0x588053bdb9582eac, 0xe9f8ce91290cad50, 0x47e2cc48ba48381f, 0xc096a9a9ba334c36,
+    0x6a38a274efee6042, 0x70551313da39b3b8, 0x47b4a34db324e978, 0x439ef31db0556f73,
+    0x5391b93f91f3d2a6, 0xe16e7be4e0126b57, 0x148aa8fad62d2def, 0x14f7e943c19a0afe,
+    0x605478e74e22ccf0, 0xe15285001c3e40b4, 0xeb590d701cbee7e6, 0x7bc7d05a43243d1c,
+    0xde7cbaea228e68d2, 0xc5a85f7957b48f03, 0x8a085f618d6cba9d, 0xb9c9b7335f69ca90,
+    0xd4156540c831016a, 0x2b3555468b45ea09, 0xf5c3ad49b0fab23f, 0x38927eba3cfa2c7c,
+    0x8b31bb66893df235, 0x2f784dde59c6cb18, 0xf1f36dc064d0a475, 0x12da99d801a1e5a4,
+    0x29cb325560b61e69, 0xb756a18eb5b776f9, 0xfee2b1d4a95ad8e4, 0x4a36a65189cabae6,
+    0xe169d123d860c461, 0x8b2e875af46a23fb, 0x35d88bfbc0c866d1, 0x55a7f1304e2ecb24,
+    0xb47657c1dedfab83, 0x676bfd395e01809b, 0xd0ea63159c33feee, 0x8a306dcb2dcab5e4,
+    0xfb66b89df2f794b6, 0x0132243024903ed5, 0x12d16ad24f74de42, 0xd2ba216d8e888392,
+    0x6ff113b38d1c4950, 0xfe8b17a30fb42f10, 0x608fa346214b7923, 0x592c1f1d98998640,
+    0x23fc176676dbb06b, 0x2d032433fb3d5166, 0xd43a8a3f101797af, 0x1fa76830460d7b69,
+    0xfe9ac5bc44207782, 0x2dfc9e4664fa1b7f, 0x4aaadbdd061a3184, 0x958c208755e39cf1,
+    0x7a76f0c63da53b03, 0x1ade1dcf168562d0, 0x0860faa71f66b51c, 0x78de86abbb743647,
+    0xc0582be8bb06ad66, 0x92837f8bcd60b70d, 0x7bad889ac6ac904d, 0x446ab0ca775fc956,
+    0x551309cd9014898e, 0x704575cb8bd24bcd, 0x1c5bff87635b5acc, 0x591656d0608fdde0,
+    0x511629d07d5bc829, 0x42a7e227e9ba6cc9, 0xd1dfb2bc25dc4926, 0x32fa2dc86eb7acf1,
+    0x51f8730ded09abcf, 0x52f1a1401e8ddabc, 0x442ffebf97e8a3db, 0x8b64c3cdbae308c1,
+    0x83dc759aba4ea63e, 0x13139513b52be673, 0xed6e27244a79bb96, 0xd562d833bd703022,
+    0x779c221926bda9fc, 0x287e36228ee852d9, 0x5db796fed1ec2e8d, 0x07590d364216cfed,
+    0xbf7f656dd95bbdbe, 0x2df9b5964f612dfb, 0x6665b8f7e5c1bda0, 0xc4b679bcbb4eb7bd,
+    0x651ee698bc106865, 0x7c190b8a19accc38, 0xbf9ccf36f1b51166, 0xb6ddb1daa4d9ff88,
+    0xe13e2c515c9fe041, 0xc51c97daea2fa022, 0xcefe238634f0d645, 0x60fdc27691b8841b,
+    0x400bd3dab40bc87b, 0xd3ce30a233a02685, 0x56586cc4de280f0b, 0xaf3bbd1fcfec3d12,
+    0x1b4a7e9c0a6ea15e, 0x3b4d7d887366f879, 0xb13e0ae707572968, 0x804363bdc335ab4e,
+    0x9a04d854e2464957, 0x14b67f914627db2f, 0xb24c59c544ffec6b, 0x000a5d03271e6968,
+    0x8824c7865c88b26c, 0x61fa52355c669dc5, 0x579429f871bb8e4a, 0xa6d26db822b7d7da,
+    0x735360b3bab77177, 0x4578edf32f51e0d2, 0x9eee813b874e6156, 0xad895c28b77fbb7e,
+    0xdc2075a276192f8b, 0x3af24568a8314457, 0xfd7deade1bd7f6ca, 0x9750bc3da5bac5cd,
+    0x74f703e2cf3971e5, 0x9952c6bfcdbd30f4, 0x43a784de295e1e1a, 0xaf9b0069fe98a7f0,
+    0x9aea3d260bcb035b, 0x48d639406902c649, 0x2a0bca1b0247c2af, 0x9a7d4bafa1281b96,
+    0xa59233c1eab2e555, 0x133f2404fe24fb32, 0x97b25617f4d500ad, 0x7c7eb020353b8be8,
+    0x5bd2b9f6d5409b21, 0x70f41b16285c1c24, 0x10c3f04f1468a9dd, 0xb9bf3c972620f9f7,
+    0x4d4a1c9d0cb7bd0f, 0x94397f2c8b36ffa3, 0x066675145aca5d6d, 0xb1a6cccd09c65e4c,
+    0x38b6499f7ff1c7bd, 0xca3027c389ab50f3, 0x619d25db2685b481, 0xb8037913fc9466eb,
+    0x00299b9a419e80b9, 0xbe093ff84f0420b4, 0xc7c499b8b864e6af, 0x0aed0050d76713a1,
+    0x4e80d3172d4f2b41, 0x8c3322fc7b962fa8, 0xc91cb0e52d97fa31, 0x53aacb43b4ae8dce,
+    0xfd117956e347a04a, 0x41b02b34d47ce0bc, 0x991754b8cb604e20, 0x77a572b8689d9c7c,
+    0x614421e35f654042, 0x1cb16065ecba55af, 0x512e87071ad06bc7, 0xf0bc03ea3756769b,
+    0x350b2b6046fde9fe, 0xb600d4846605ab2d, 0x82d4fa7e291ac9a2, 0x4d53b70e7edba7d4,
+    0x3b7a334d808185b3, 0x22a0339ae921342f, 0xe7f1cf4b97a046ff, 0x278a68a5b493c387,
+    0xcfb6521ff3eadc7b, 0xf659d6b010fa5ff6, 0x887d1fd3292be217, 0x9ed8b9e3029a4e65,
+    0xedc183a3fc49136e, 0xe6d025ea0ed5c155, 0x2de0beffc0f2eda7, 0xb330bf70ec381a76,
+    0x59b9621c78c2e808, 0x3d1e31792f407531, 0xe38e52b38de3a26e, 0xe06d47bc6d2282ab,
+    0xdaf357005d5bf815, 0x713a399416cb9871, 0xe8dbe660b309ec08, 0x5db7c0b2b5c95ba8,
+    0x3392ba613c108630, 0x4dd85deae3ec6d76, 0x6a2cc84b3995c516, 0xabd6d31499077e61,
+    0x9c0c93957c55d46c, 0x6cb36a7519c82a97, 0xe73493fa87a814ab, 0x3ec2a35d8fd47af2,
+    0x2a59fb6262677496, 0x3e3d5a7a63083043, 0x449bca265a77448a, 0x66434fc90e424bb2,
+    0x0f056669f0074b10, 0xd99e71c63d4caab9, 0x7196939ff64de58c, 0x655c975530dc1cd3,
+    0x44411f1831d26d03, 0xcd5cd17fe7347da8, 0x60891d8917909091, 0xb71e7743aa4853b0,
+    0xccda97a0a7bdf3c6, 0x0fd8c6bc63815978, 0xb934854a062720e0, 0x9673c67e5a298015,
+    0x23398cf687945c5c, 0xaf0877850e4b1939, 0x99b02ffcffc2f683, 0x336addcf981b3866,
+    0x29ba4333742fe137, 0xc18d0d1f8bb4db24, 0xfa11da3016d64831, 0xd842ec235f496636,
+    0x766a8e655e70cb8f, 0x2ce27b6a93180f23, 0xd2c4f116e6abe4af, 0x562440ff6223fb90,
+    0xcb4e4d6866132bc8, 0x391d4eee84c93f1a, 0x9601a8599c4ecfe8, 0x48e48de4e7a3f68e,
+    0x83e1cc2c8ec34ed6, 0x8483e0e6b428efef, 0x29f17062ba35c77e, 0xef8e9c081780a93c,
+    0xcc98d12f6722b411, 0x373fb7022142006a, 0xbddff36ef293b87b, 0x66bd93782ba67262,
+    0xc8744386e37abcdd, 0xd7786948816f029e, 0x91f54bc6755f142c, 0xdd7d1e7d5a99ed14,
+    0x5bec83837df718d7, 0xe19d501ac8d35177, 0xde5841dc8db6c791, 0xb191560ebd435319,
+    0x54c21d19dc4ea023, 0x525bb6860cf96e25, 0x5e4a690f878f60ab, 0xe72a627b13d9128d,
+    0x50d2a5695b90330e, 0x393a5487c28da58c, 0x290e05581fadeb8d, 0x8860fead4b55cbeb,
+    0x447e0677825656db, 0x9be09e83d51fc2e9, 0x8bfef28ef2a9f11e, 0xf91331465a7cc44d,
+    0x318d7ae2107ee680, 0x8fc887817fb91ce3, 0x6f63145d567fe4db, 0xfb00b27dbc5050af,
+    0xe19d7dbb691fa04d, 0x2c5c319c75793f28, 0xdaba361c3ad13e14, 0x2a0d4f1c31c4ec36,
+    0x0523c2990f6e963d, 0x3b0bb6858f682393, 0xc18788000d96e73c, 0xb7d55b48af2e1ee4,
+    0xd235affbd9c51595, 0xe55e01f9c5614c38, 0x38a64ed8cb969212, 0x45adc8146b3d654f,
+    0x6975246f55722917, 0x0c786466d853ff74, 0x1dcffad300e238dc, 0xd5fa86f083db1484,
+    0x7f66d488887f9faa, 0x835beab696e0a0e9, 0xdea81a4ecf01a2a7, 0x3a3310084e9cfd2c,
+    0x1e24a29124355979, 0x8ec31977f1145bee, 0x822e4fbf05db32f3, 0x213bbeee207818aa,
+    0xdc1a6ea8f189ea4d, 0x880b757504a3ab2d, 0xf65856d2a22ff7ef, 0xf01df27de2568264,
+    0xfba75fc10c79a5ac, 0x884fcee23ae06160, 0xee07aa12653aedf0, 0x1d06b762b56b3fbe,
+    0x2e7bf444301500cc, 0xa3e9c6cb122e6da7, 0xd9b9556c5489e7b0, 0xf6e6cf26633ae9c3,
+    0x106377ea022b9ff4, 0x8753e87fab468f6d, 0x7fd92a245c8b5d5d, 0x3723ef620c2e1f27,
+    0x9bfc3b206c327d73, 0x29e045334acf9810, 0x868d7fb955fdd732, 0x96ae06b490fdf27c,
+    0x40edc72667f08db4, 0x76d24ded87d19d8e, 0x343348c7963f2ce1, 0x5b535a3486c6acdf,
+    0x0dd443562e77a21d, 0x5e2df7cf55910223, 0x2830f9e6e1c9cf21, 0x77a78fd4fd729dfc,
+    0x57ccd9b6ba568ea0, 0x315b27a1e25785c6, 0x832ca8fb2f8a2d4a, 0xda98b6a437504fd8,
+    0x12e47ad4f259c39c, 0x51e59cb95a9200ea, 0x2f319a2aae3460e5, 0x99b1c6bdb368a5ca,
+    0x3d9db6ada38c7ece, 0x1697df91d1c6296c, 0xb6bcc881651bc311, 0x22eed72a51aff72a,
+    0xf7028b5a4824aaf5, 0x93ed69ecfa1a8c93, 0x84b05febedf28ce7, 0x8346ee1fee52b8cf,
+    0x435518002d029b23, 0x7a86fa794075a0f5, 0x2b52d5001d92925f, 0x3adacd2dad9c3019,
+    0x42240d4f547d0ae3, 0x9b324528b8982963, 0x974cb343e0c21407, 0xae48eec475806aa4,
+    0xe70745fb714963cb, 0x1c3452ba9a646ac7, 0xa4a00c3ac313a4b1, 0x553f2a786567ced0,
+    0xa3023f870944f868, 0x9b5ccad6eb9821d3, 0xe9026cfb02e7309b, 0x88c5b41293ab5808,
+    0xf9992004c5c36d1b, 0xf2759f5771668a21, 0xc72c9197fa950dd5, 0x9bdc54fef46c6dfd,
+    0xfda5a843d6aec91b, 0x6316031af6813cea, 0x81017a330900c1d5, 0xc102a07bcf1c0035,
+    0xeb249d3617c80216, 0x42993cd698388523, 0xd45805b9c890b88c, 0x786a7b9a4151fef8,
+    0x8cd12fd509bd95fd, 0xf4575bc3f90eaf5f, 0x48a3d47c111767a3, 0x15bb5347c6722d0c,
+    0xfb3b636498654e3f, 0xbc9e9db5f4d2045c, 0x524b74bcda4cf193, 0x838664a3108f10b4,
+    0x90b3bcc80efc9b0b, 0x2e2f3b1c548e6ce0, 0x02d6e2563ab025ca, 0xeed3e1506adb1455,
+    0xfea4e84e35aa059e, 0x0277037d0490655e, 0xee33f7007b3f4abb, 0x49dc51bef443c56b,
+    0x1b709ef81c82ef09, 0xd14975359a19de2b, 0xa30ac305bf87ef1e, 0xb34807dd1e4377bd,
+    0xcbb7e1799946034a, 0x3fcf8043cb717853, 0x82373be589f579ac, 0xab919564b2062846,
+    0xe1c820bed3750b75, 0x79340a22a9cb2f28, 0xf3cf0e2aecf9f7ea, 0xf39648e49c2d22d3,
+    0x4be2bb4aac5bc0c0, 0x0b4719f4ab9dda8e, 0x45fe8b119abddeb1, 0x8b10a3b9aa566098,
+    0xf720ed8f273f697a, 0xbab228afaf779165, 0xa623e0da80e640b4, 0x6ad390c770d804f7,
+    0xeed573479b625779, 0x52cd04c762ef6123, 0x6401f20f3f440e34, 0x73668d84bc5477f0,
+    0x1bb9d1fa673b9cb2, 0xf9858dcda18f7130, 0x756433a2ab3ff805, 0x0735a043f6daa5f7,
+    0x87d2b00cda9678b9, 0x3551464faba57d19, 0x71ab125642ae00b3, 0xa7b8990f1b6cef5a,
+    0x42d4bfb705b4d65a, 0x0c9e33411006c256, 0x6e43ffad82d476f7, 0xbe7136b6501f510f,
+    0x9f7fd61d38344152, 0x828acc60a791dea3, 0x7b25ed8a2e3f8e66, 0x1f642b393643d1ca,
+    0x94ae3535b127eb0e, 0x86b652e76f60414f, 0x9d6e9b2769b9c16d, 0xe51bc5267ac78bff,
+    0x40a1e2441f18c538, 0xf40235e1e7d19301, 0x934097c65bb3b37b, 0x13f89a09bcfa9339,
+    0xda1b72ed0ac7a0b4, 0xf93a606da0610e04, 0x5008aab0a3fdfe96, 0x7b9460033dfef9d0,
+    0x168c518ef2f11f24, 0x5403ff6f1c6390d2, 0xae1dd43b56bea6f2, 0xfd33cac98248594c,
+    0xce946b171881256e, 0x453f51107d84604e, 0xb65b49f5ee369a42, 0x9d75ee0f5a9d9ce6,
+    0x868e7d2312fa88af, 0x531d377138c15a03, 0xae87c2d1a1b2b09a, 0x794d5dd3e32bbd6b,
+    0x6afdc90ff8f09a20, 0xf4d9eefbff5c21d7, 0xf224c97bcff97d23, 0x29341fd36ea4eba6,
+    0x5f9f1d13be0297ce, 0xe2b11861c61551d7, 0x6e861dd940173350, 0xdb35e24ad49bf296,
+    0xba6bf94687fb8044, 0x4b08369408991ec5, 0x586289b86fcf49a6, 0x5c3fff2936415b9c,
+    0x20c7d0062bea8726, 0x497911ac0485d8b0, 0xcc57450ff93f0f21, 0xd26999e1e48a1b76,
+    0xf9c5817f937c2541, 0x25bc3752b5ce15e3, 0x967ed735e58a0e62, 0x1e5cae5a47462eee,
+    0xe0c9ba6946b4d4c7, 0x48a4f81bc23077a5, 0x03b7d4f3842bf198, 0xf09dbe1f39219c33,
+    0x9e1d686c8ebee94f, 0x81cfbbf0390ffe69, 0xda968e9fbf524850, 0x26fca7cc9b91d7ea,
+    0xb19d5bd047761ea9, 0x2aed1b9be0a7ce06, 0x38402073efcf6a10, 0x454c09f495fe69b5,
+    0xeb42606c7fbd1f9f, 0xcd851fbd3edbdc3c, 0xa7719cb6a015b573, 0xd9ba18b2e69e9d19,
+    0x43dee7bddaea5cf6, 0xff1c2da050fb5414, 0x1c9a10e015c60d47, 0x752b82e9b1134489,
+    0xc1d122c23fd9dab9, 0x993e60c1c1578641, 0x287579b2145ce7c3, 0x53c10c7ead193583,
+    0xf337cf059aa24ad9, 0x0a587b293bf91015, 0xc90b9214af9eadb0, 0x447333ec8aa6681e,
+    0x2fe754b3b9c9e855, 0xb5dbaae1bad0c5e3, 0xcb6141de15565889, 0xc042b135644d585f,
+    0x8678bcd4b39a64fc, 0xbf520c6c3624285f, 0x275bb6e5e0fc8c0f, 0x3339e74541e3c33c,
+    0x8138e2e97412bac6, 0x02af377814a8d2b0, 0x2b6067930c058c8c, 0x146c853e135e4292,
+    0xbc2f675cd71861f8, 0x0ddf3a334dd80077, 0xaabadce755ff2c00, 0xea70f52b240856e8,
+    0xe599da24a0803997, 0xcaf348aea0286da5, 0xc7034688f49487b9, 0x220bb1f3f19b23b9,
+    0xd8f760ffd8ffa64a, 0x7046415257483427, 0x77c67eaa4eef01bd, 0xf73b5fe39094d33e,
+    0x294b05dc00531896, 0xdc896f05d5ed8346, 0xcc9d6281c51d2584, 0xf25f721b20824fe8,
+    0x0e8bedf5b8edd9b2, 0x75f7f28c16de43f5, 0x2530cda73dfddd88, 0x2c39ce93a3601195,
+    0xebebcf600b5cbf83, 0x5c0457dbfb605968, 0xa08efb715f8901c3, 0x1507eb99f2b78c97,
+    0xb8635ab33a33db3a, 0x12914e514e92c0ef, 0x74f42859c59ed4ba, 0xc742b06358dfa742,
+    0x0c9e33dc89608d8d, 0x542e0c2b60df19dd, 0x6bb4a247648d389b, 0x1f0df6ee5958dbb2,
+    0x1a5b71814954a513, 0xb984b68c0183a92e, 0x2f4880d4141d4675, 0xfa9154db3cc5d2f8,
+    0x31a54ced094b6746, 0xba85644a9b1aafe9, 0x503b1a6a7d2c0d40, 0xe3bd788308437de9,
+    0xf8f74f6cc1df2fab, 0x19864bf16f65b271, 0x512a5673eb84fa7b, 0xb585a901bca37112,
+    0xad2782dcef3abdaf, 0xabad843906815339, 0x3acf8f6cd2bc23cd, 0x37794131c592a7f4,
+    0xb0fc162398839ced, 0xbbd87df10f4a0ae3, 0xfea93e79c4f0bb0a, 0x95cdfc0a5215283e,
+    0x03b1c10169a97eb2, 0xbba7f3273c16379a, 0x75530c94d248c3ca, 0x0caf864d3f99ab3c,
+    0xc7dd2cec5776ec3e, 0x0a1fe9ec2ac1e613, 0x61699cab1873e20d, 0xa6c584ab8cc16c7c,
+    0x48227ef802ed5dc1, 0x808010b27d2de0ee, 0x1fca3e7b2923b870, 0x21b065df4732cbac,
+    0xf129eb4ac8fba5ed, 0xfb35b0375928f05f, 0x81c58197fc8c8341, 0xfcbc237e09cbb3a9,
+    0x9c49ba2d9d3eb245, 0x1e5653a994a94d02, 0x306c614c1a326e18, 0xc1ea0d5c9830a436,
+    0x0f1aaa4f5712fc97, 0x32e5557a8e1a31ba, 0x20c5b4f261abdea7, 0x3918a9b3fdb7f0f2,
+    0x8de348c9ba2d14da, 0x08cb437b3d42c13d, 0xbfaf825c829ed8cf, 0x27d090086d547dda,
+    0x80985c6d46dee7a3, 0x50011f27cc2fd56b, 0x80b959ae34a2b8ce, 0xf9b18a8befd08c11,
+    0xe42594ae7edd50ed, 0x87d5830e9ea013c2, 0x4615a28438894458, 0xae9df245c576291b,
+    0xae10c47295be2e33, 0x3720e873c966c630
+};
+
+// The start position keys, initialized at startup
 static uint64_t startPosZobristKey = 0;
-
-void initZobristTable() {
-    std::mt19937_64 rng (61280152908);
-    for (int i = 0; i < 794; i++)
-        zobristTable[i] = rng();
-
+static uint64_t startPosPawnZobristKey = 0;
+static uint64_t startPosMaterialZobristKey = 0;
+static Score startPosPsqtScores[2] = {EVAL_ZERO, EVAL_ZERO};
+constexpr int8_t START_POS_MAILBOX[64] = {
+     3,  1,  2,  4,  5,  2,  1,  3,
+     0,  0,  0,  0,  0,  0,  0,  0,
+    -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1,
+     6,  6,  6,  6,  6,  6,  6,  6,
+     9,  7,  8, 10, 11,  8,  7,  9
+};
+
+// The material key uses the piece square keys indexed by piece count instead
+// of square: the key of the nth piece of a type is that type's key for square n
+inline uint64_t materialKey(int color, int pieceID, int pieceCount) {
+    return zobristTable[384*color + 64*pieceID + pieceCount];
+}
+
+void initStartPosKeys() {
     Board b;
-    int *mailbox = b.getMailbox();
-    b.initZobristKey(mailbox);
+    b.initZobristKey();
+    b.initPsqtScores();
     startPosZobristKey = b.getZobristKey();
-    delete[] mailbox;
+    startPosPawnZobristKey = b.getPawnZobristKey();
+    startPosMaterialZobristKey = b.getMaterialZobristKey();
+    startPosPsqtScores[WHITE] = b.getPsqtScore(WHITE);
+    startPosPsqtScores[BLACK] = b.getPsqtScore(BLACK);
 }
 
 // Magic tables, initialized in bbinit.cpp
-extern uint64_t *attackTable;
 extern MagicInfo magicBishops[64];
 extern MagicInfo magicRooks[64];
 
-// Precalculated bitboard tables
-extern uint64_t inBetweenSqs[64][64];
-
 
 //------------------------------------------------------------------------------
 //--------------------------------Constructors----------------------------------
@@ -75,8 +296,13 @@ Board::Board() {
     pieces[BLACK][ROOKS] = 0x8100000000000000; // black rooks
     pieces[BLACK][QUEENS] = 0x0800000000000000; // black queens
     pieces[BLACK][KINGS] = 0x1000000000000000; // black kings
+    std::memcpy(mailbox, START_POS_MAILBOX, sizeof(mailbox));
 
     zobristKey = startPosZobristKey;
+    pawnZobristKey = startPosPawnZobristKey;
+    materialZobristKey = startPosMaterialZobristKey;
+    psqtScores[WHITE] = startPosPsqtScores[WHITE];
+    psqtScores[BLACK] = startPosPsqtScores[BLACK];
     epCaptureFile = NO_EP_POSSIBLE;
     playerToMove = WHITE;
     moveNumber = 1;
@@ -98,7 +324,10 @@ Board::Board(int *mailboxBoard, bool _whiteCanKCastle, bool _blackCanKCastle,
     for (int i = 0; i < 64; i++) {
         if (0 <= mailboxBoard[i] && mailboxBoard[i] <= 11) {
             pieces[mailboxBoard[i]/6][mailboxBoard[i]%6] |= indexToBit(i);
+            mailbox[i] = (int8_t) mailboxBoard[i];
         }
+        else
+            mailbox[i] = -1;
     }
     allPieces[WHITE] = 0;
     for (int i = 0; i < 6; i++)
@@ -120,7 +349,8 @@ Board::Board(int *mailboxBoard, bool _whiteCanKCastle, bool _blackCanKCastle,
     if (_blackCanQCastle)
         castlingRights |= BLACKQSIDE;
     fiftyMoveCounter = _fiftyMoveCounter;
-    initZobristKey(mailboxBoard);
+    initZobristKey();
+    initPsqtScores();
 
     kingSqs[WHITE] = bitScanForward(pieces[WHITE][KINGS]);
     kingSqs[BLACK] = bitScanForward(pieces[BLACK][KINGS]);
@@ -141,7 +371,10 @@ Board Board::staticCopy() const {
 /**
  * @brief Updates the board and Zobrist keys with Move m.
  */
-void Board::doMove(Move m, int color) {
+// The side to move is a template parameter so that the color indexing, and the
+// castling cases of the other side, are resolved at compile time
+template <int color>
+void Board::doMove(Move m) {
     int startSq = getStartSq(m);
     int endSq = getEndSq(m);
     int pieceID = getPieceOnSquare(color, startSq);
@@ -166,6 +399,14 @@ void Board::doMove(Move m, int color) {
             zobristKey ^= zobristTable[384*color + startSq];
             zobristKey ^= zobristTable[384*color + 64*promotionType + endSq];
             zobristKey ^= zobristTable[384*(color^1) + 64*captureType + endSq];
+            pawnZobristKey ^= zobristTable[384*color + startSq];
+            materialZobristKey ^= materialKey(color, PAWNS, count(pieces[color][PAWNS]));
+            materialZobristKey ^= materialKey(color, promotionType, count(pieces[color][promotionType]) - 1);
+            materialZobristKey ^= materialKey(color^1, captureType, count(pieces[color^1][captureType]));
+            psqtScores[color] += PSQT[color][promotionType][endSq] - PSQT[color][PAWNS][startSq];
+            psqtScores[color^1] -= PSQT[color^1][captureType][endSq];
+            mailbox[startSq] = -1;
+            mailbox[endSq] = (int8_t) (6*color + promotionType);
         }
         else {
             pieces[color][PAWNS] &= ~indexToBit(startSq);
@@ -176,6 +417,12 @@ void Board::doMove(Move m, int color) {
 
             zobristKey ^= zobristTable[384*color + startSq];
             zobristKey ^= zobristTable[384*color + 64*promotionType + endSq];
+            pawnZobristKey ^= zobristTable[384*color + startSq];
+            materialZobristKey ^= materialKey(color, PAWNS, count(pieces[color][PAWNS]));
+            materialZobristKey ^= materialKey(color, promotionType, count(pieces[color][promotionType]) - 1);
+            psqtScores[color] += PSQT[color][promotionType][endSq] - PSQT[color][PAWNS][startSq];
+            mailbox[startSq] = -1;
+            mailbox[endSq] = (int8_t) (6*color + promotionType);
         }
         epCaptureFile = NO_EP_POSSIBLE;
         fiftyMoveCounter = 0;
@@ -195,6 +442,15 @@ void Board::doMove(Move m, int color) {
             zobristKey ^= zobristTable[384*color + startSq];
             zobristKey ^= zobristTable[384*color + endSq];
             zobristKey ^= zobristTable[384*(color^1) + capSq];
+            pawnZobristKey ^= zobristTable[384*color + startSq];
+            pawnZobristKey ^= zobristTable[384*color + endSq];
+            pawnZobristKey ^= zobristTable[384*(color^1) + capSq];
+            materialZobristKey ^= materialKey(color^1, PAWNS, count(pieces[color^1][PAWNS]));
+            psqtScores[color] += PSQT[color][PAWNS][endSq] - PSQT[color][PAWNS][startSq];
+            psqtScores[color^1] -= PSQT[color^1][PAWNS][capSq];
+            mailbox[startSq] = -1;
+            mailbox[endSq] = (int8_t) (6*color + PAWNS);
+            mailbox[capSq] = -1;
         }
         else {
             int captureType = getPieceOnSquare(color^1, endSq);
@@ -209,13 +465,24 @@ void Board::doMove(Move m, int color) {
             zobristKey ^= zobristTable[384*color + 64*pieceID + startSq];
             zobristKey ^= zobristTable[384*color + 64*pieceID + endSq];
             zobristKey ^= zobristTable[384*(color^1) + 64*captureType + endSq];
+            if (pieceID == PAWNS) {
+                pawnZobristKey ^= zobristTable[384*color + startSq];
+                pawnZobristKey ^= zobristTable[384*color + endSq];
+            }
+            if (captureType == PAWNS)
+                pawnZobristKey ^= zobristTable[384*(color^1) + endSq];
+            materialZobristKey ^= materialKey(color^1, captureType, count(pieces[color^1][captureType]));
+            psqtScores[color] += PSQT[color][pieceID][endSq] - PSQT[color][pieceID][startSq];
+            psqtScores[color^1] -= PSQT[color^1][captureType][endSq];
+            mailbox[startSq] = -1;
+            mailbox[endSq] = (int8_t) (6*color + pieceID);
         }
         epCaptureFile = NO_EP_POSSIBLE;
         fiftyMoveCounter = 0;
     } // end capture
     else { // Quiet moves
         if (isCastle(m)) {
-            if (endSq == 6) { // white kside
+            if (color == WHITE && endSq == 6) { // white kside
                 pieces[WHITE][KINGS] &= ~indexToBit(4);
                 pieces[WHITE][KINGS] |= indexToBit(6);
                 pieces[WHITE][ROOKS] &= ~indexToBit(7);
@@ -230,8 +497,13 @@ void Board::doMove(Move m, int color) {
                 zobristKey ^= zobristTable[64*KINGS+6];
                 zobristKey ^= zobristTable[64*ROOKS+7];
                 zobristKey ^= zobristTable[64*ROOKS+5];
+                psqtScores[WHITE] += PSQT[WHITE][KINGS][6] - PSQT[WHITE][KINGS][4];
+                psqtScores[WHITE] += PSQT[WHITE][ROOKS][5] - PSQT[WHITE][ROOKS][7];
+                mailbox[4] = mailbox[7] = -1;
+                mailbox[6] = KINGS;
+                mailbox[5] = ROOKS;
             }
-            else if (endSq == 2) { // white qside
+            else if (color == WHITE) { // white qside
                 pieces[WHITE][KINGS] &= ~indexToBit(4);
                 pieces[WHITE][KINGS] |= indexToBit(2);
                 pieces[WHITE][ROOKS] &= ~indexToBit(0);
@@ -246,6 +518,11 @@ void Board::doMove(Move m, int color) {
                 zobristKey ^= zobristTable[64*KINGS+2];
                 zobristKey ^= zobristTable[64*ROOKS+0];
                 zobristKey ^= zobristTable[64*ROOKS+3];
+                psqtScores[WHITE] += PSQT[WHITE][KINGS][2] - PSQT[WHITE][KINGS][4];
+                psqtScores[WHITE] += PSQT[WHITE][ROOKS][3] - PSQT[WHITE][ROOKS][0];
+                mailbox[4] = mailbox[0] = -1;
+                mailbox[2] = KINGS;
+                mailbox[3] = ROOKS;
             }
             else if (endSq == 62) { // black kside
                 pieces[BLACK][KINGS] &= ~indexToBit(60);
@@ -262,6 +539,11 @@ void Board::doMove(Move m, int color) {
                 zobristKey ^= zobristTable[384+64*KINGS+62];
                 zobristKey ^= zobristTable[384+64*ROOKS+63];
                 zobristKey ^= zobristTable[384+64*ROOKS+61];
+                psqtScores[BLACK] += PSQT[BLACK][KINGS][62] - PSQT[BLACK][KINGS][60];
+                psqtScores[BLACK] += PSQT[BLACK][ROOKS][61] - PSQT[BLACK][ROOKS][63];
+                mailbox[60] = mailbox[63] = -1;
+                mailbox[62] = 6 + KINGS;
+                mailbox[61] = 6 + ROOKS;
             }
             else { // black qside
                 pieces[BLACK][KINGS] &= ~indexToBit(60);
@@ -278,6 +560,11 @@ void Board::doMove(Move m, int color) {
                 zobristKey ^= zobristTable[384+64*KINGS+58];
                 zobristKey ^= zobristTable[384+64*ROOKS+56];
                 zobristKey ^= zobristTable[384+64*ROOKS+59];
+                psqtScores[BLACK] += PSQT[BLACK][KINGS][58] - PSQT[BLACK][KINGS][60];
+                psqtScores[BLACK] += PSQT[BLACK][ROOKS][59] - PSQT[BLACK][ROOKS][56];
+                mailbox[60] = mailbox[56] = -1;
+                mailbox[58] = 6 + KINGS;
+                mailbox[59] = 6 + ROOKS;
             }
             epCaptureFile = NO_EP_POSSIBLE;
             fiftyMoveCounter++;
@@ -291,9 +578,15 @@ void Board::doMove(Move m, int color) {
 
             zobristKey ^= zobristTable[384*color + 64*pieceID + startSq];
             zobristKey ^= zobristTable[384*color + 64*pieceID + endSq];
+            psqtScores[color] += PSQT[color][pieceID][endSq] - PSQT[color][pieceID][startSq];
+            mailbox[startSq] = -1;
+            mailbox[endSq] = (int8_t) (6*color + pieceID);
 
             // check for en passant
             if (pieceID == PAWNS) {
+                pawnZobristKey ^= zobristTable[384*color + startSq];
+                pawnZobristKey ^= zobristTable[384*color + endSq];
+
                 if (getFlags(m) == MOVE_DOUBLE_PAWN)
                     epCaptureFile = startSq & 7;
                 else
@@ -344,32 +637,193 @@ void Board::doMove(Move m, int color) {
     zobristKey ^= zobristTable[768];
 }
 
+void Board::doMove(Move m, int color) {
+    if (color == WHITE)
+        doMove<WHITE>(m);
+    else
+        doMove<BLACK>(m);
+}
+
+// Does a move, saving the state needed to undo it afterwards.
+void Board::doMove(Move m, int color, UndoInfo &undo) {
+    undo.zobristKey = zobristKey;
+    undo.pawnZobristKey = pawnZobristKey;
+    undo.materialZobristKey = materialZobristKey;
+    undo.psqtScores[WHITE] = psqtScores[WHITE];
+    undo.psqtScores[BLACK] = psqtScores[BLACK];
+    undo.capturedPiece = getPieceOnSquare(color^1, getEndSq(m));
+    undo.epCaptureFile = epCaptureFile;
+    undo.castlingRights = castlingRights;
+    undo.fiftyMoveCounter = fiftyMoveCounter;
+    doMove(m, color);
+}
+
 bool Board::doPseudoLegalMove(Move m, int color) {
     doMove(m, color);
     // Pseudo-legal moves require a check for legality
     return !(isInCheck(color));
 }
 
+// Does a pseudo-legal move. If the move turns out to be illegal, it is undone
+// and false is returned.
+bool Board::doPseudoLegalMove(Move m, int color, UndoInfo &undo) {
+    doMove(m, color, undo);
+    // Pseudo-legal moves require a check for legality
+    if (isInCheck(color)) {
+        undoMove(m, undo);
+        return false;
+    }
+    return true;
+}
+
 // Do a hash move, which requires a few more checks in case of a Type-1 error.
-bool Board::doHashMove(Move m, int color) {
-    int pieceID = getPieceOnSquare(color, getStartSq(m));
-    // Check that the start square is not empty
-    if (pieceID == -1)
+// The board is left unchanged if false is returned.
+bool Board::doHashMove(Move m, int color, UndoInfo &undo) {
+    if (!isPseudoLegal(m, color))
         return false;
 
-    // Check that the end square has correct occupancy
-    uint64_t otherPieces = allPieces[color^1];
-    uint64_t endSingle = indexToBit(getEndSq(m));
-    bool captureRoutes = (isCapture(m) && (otherPieces & endSingle))
-                      || (isCapture(m) && pieceID == PAWNS && (~otherPieces & endSingle));
-    uint64_t empty = ~getOccupancy();
-    if (!(captureRoutes || (!isCapture(m) && (empty & endSingle))))
+    return doPseudoLegalMove(m, color, undo);
+}
+
+/*
+ * Returns true if m could have come from the pseudo-legal move generator in
+ * this position. Used to verify moves that were not generated here, such as
+ * hash moves and killers, before they are searched.
+ */
+bool Board::isPseudoLegal(Move m, int color) const {
+    int startSq = getStartSq(m);
+    int endSq = getEndSq(m);
+    int pieceID = getPieceOnSquare(color, startSq);
+    // Check that the start square has one of our pieces
+    if (m == NULL_MOVE || pieceID == -1)
         return false;
+
+    // Castling is rare, so compare against the castles generator
+    if (isCastle(m)) {
+        MoveList castles;
+        if (color == WHITE)
+            addCastlesToList<WHITE>(castles);
+        else
+            addCastlesToList<BLACK>(castles);
+        for (unsigned int i = 0; i < castles.size(); i++) {
+            if (castles.get(i) == m)
+                return true;
+        }
+        return false;
+    }
+
+    uint64_t startSingle = indexToBit(startSq);
+    uint64_t endSingle = indexToBit(endSq);
+    uint64_t otherPieces = allPieces[color^1];
+    uint64_t occ = getOccupancy();
     // Check that the king is not captured
-    if (isCapture(m) && ((endSingle & pieces[WHITE][KINGS]) || (endSingle & pieces[BLACK][KINGS])))
+    if (endSingle & (pieces[WHITE][KINGS] | pieces[BLACK][KINGS]))
         return false;
 
-    return doPseudoLegalMove(m, color);
+    if (pieceID == PAWNS) {
+        uint64_t pawnCaptures = (color == WHITE) ? getWPawnCaptures(startSingle)
+                                                 : getBPawnCaptures(startSingle);
+        if (isEP(m)) {
+            int rankDiff = (color == WHITE) ? 8 : -8;
+            return epCaptureFile != NO_EP_POSSIBLE
+                && endSq == epVictimSquare(color^1, epCaptureFile) + rankDiff
+                && (pawnCaptures & endSingle);
+        }
+
+        // Pawn moves to the final rank must be promotions, and only those
+        uint64_t finalRank = (color == WHITE) ? RANK_8 : RANK_1;
+        if (isPromotion(m) != ((endSingle & finalRank) != 0))
+            return false;
+        if (!isPromotion(m) && (getFlags(m) & 0x2))
+            return false;
+
+        if (isCapture(m))
+            return (pawnCaptures & otherPieces & endSingle) != 0;
+        if (getFlags(m) == MOVE_DOUBLE_PAWN) {
+            uint64_t doubleMoves = (color == WHITE) ? getWPawnDoubleMoves(startSingle)
+                                                    : getBPawnDoubleMoves(startSingle);
+            return (doubleMoves & endSingle) != 0;
+        }
+        uint64_t singleMoves = (color == WHITE) ? getWPawnSingleMoves(startSingle)
+                                                : getBPawnSingleMoves(startSingle);
+        return (singleMoves & endSingle) != 0;
+    }
+
+    // Other pieces have no flags besides the capture flag
+    if (isPromotion(m) || (getFlags(m) & 0x3))
+        return false;
+    // Check that the end square has correct occupancy
+    if (!((isCapture(m) ? otherPieces : ~occ) & endSingle))
+        return false;
+
+    uint64_t attacks;
+    switch (pieceID) {
+        case KNIGHTS: attacks = getKnightSquares(startSq); break;
+        case BISHOPS: attacks = getBishopSquares(startSq, occ); break;
+        case ROOKS: attacks = getRookSquares(startSq, occ); break;
+        case QUEENS: attacks = getQueenSquares(startSq, occ); break;
+        default: attacks = getKingSquares(startSq); break;
+    }
+    return (attacks & endSingle) != 0;
+}
+
+// Takes back a move made by doMove(m, color, undo), which must be the last
+// move made on this board.
+void Board::undoMove(Move m, const UndoInfo &undo) {
+    int color = playerToMove ^ 1;
+    int startSq = getStartSq(m);
+    int endSq = getEndSq(m);
+    uint64_t startSingle = indexToBit(startSq);
+    uint64_t endSingle = indexToBit(endSq);
+
+    if (isCastle(m)) {
+        // The rook's start and end squares relative to the king's end square
+        int rookStart = (endSq & 7) == 6 ? endSq + 1 : endSq - 2;
+        int rookEnd = (endSq & 7) == 6 ? endSq - 1 : endSq + 1;
+        uint64_t rookSqs = indexToBit(rookStart) | indexToBit(rookEnd);
+        pieces[color][KINGS] ^= startSingle | endSingle;
+        pieces[color][ROOKS] ^= rookSqs;
+        allPieces[color] ^= startSingle | endSingle | rookSqs;
+        mailbox[endSq] = mailbox[rookEnd] = -1;
+        mailbox[startSq] = (int8_t) (6*color + KINGS);
+        mailbox[rookStart] = (int8_t) (6*color + ROOKS);
+        kingSqs[color] = startSq;
+    }
+    else {
+        int endPiece = mailbox[endSq] - 6*color;
+        int pieceID = isPromotion(m) ? PAWNS : endPiece;
+        pieces[color][endPiece] &= ~endSingle;
+        pieces[color][pieceID] |= startSingle;
+        allPieces[color] ^= startSingle | endSingle;
+        mailbox[startSq] = (int8_t) (6*color + pieceID);
+        mailbox[endSq] = -1;
+        if (pieceID == KINGS)
+            kingSqs[color] = startSq;
+
+        if (isEP(m)) {
+            int capSq = epVictimSquare(color^1, undo.epCaptureFile);
+            pieces[color^1][PAWNS] |= indexToBit(capSq);
+            allPieces[color^1] |= indexToBit(capSq);
+            mailbox[capSq] = (int8_t) (6*(color^1) + PAWNS);
+        }
+        else if (isCapture(m)) {
+            pieces[color^1][undo.capturedPiece] |= endSingle;
+            allPieces[color^1] |= endSingle;
+            mailbox[endSq] = (int8_t) (6*(color^1) + undo.capturedPiece);
+        }
+    }
+
+    zobristKey = undo.zobristKey;
+    pawnZobristKey = undo.pawnZobristKey;
+    materialZobristKey = undo.materialZobristKey;
+    psqtScores[WHITE] = undo.psqtScores[WHITE];
+    psqtScores[BLACK] = undo.psqtScores[BLACK];
+    epCaptureFile = undo.epCaptureFile;
+    castlingRights = undo.castlingRights;
+    fiftyMoveCounter = undo.fiftyMoveCounter;
+    if (color == BLACK)
+        moveNumber--;
+    playerToMove = color;
 }
 
 // Handle null moves for null move pruning by switching the player to move.
@@ -390,16 +844,71 @@ void Board::undoNullMove(uint16_t _epCaptureFile) {
 }
 
 
+// Computes the Zobrist key that doMove(m, color) would produce, so that the
+// hash entry of the resulting position can be prefetched before the move is
+// made. The move must be pseudo-legal in this position.
+uint64_t Board::getZobristKeyAfterMove(Move m, int color) const {
+    int startSq = getStartSq(m);
+    int endSq = getEndSq(m);
+    int pieceID = getPieceOnSquare(color, startSq);
+    uint64_t key = zobristKey ^ zobristTable[768];
+    key ^= zobristTable[769 + castlingRights];
+    key ^= zobristTable[785 + epCaptureFile];
+
+    uint8_t newCastlingRights = castlingRights;
+    uint16_t newEPCaptureFile = NO_EP_POSSIBLE;
+
+    if (isCastle(m)) {
+        // The rook's start and end squares relative to the king's end square
+        int rookStart = (endSq & 7) == 6 ? endSq + 1 : endSq - 2;
+        int rookEnd = (endSq & 7) == 6 ? endSq - 1 : endSq + 1;
+        key ^= zobristTable[384*color + 64*KINGS + startSq];
+        key ^= zobristTable[384*color + 64*KINGS + endSq];
+        key ^= zobristTable[384*color + 64*ROOKS + rookStart];
+        key ^= zobristTable[384*color + 64*ROOKS + rookEnd];
+    }
+    else {
+        int endPiece = isPromotion(m) ? getPromotion(m) : pieceID;
+        key ^= zobristTable[384*color + 64*pieceID + startSq];
+        key ^= zobristTable[384*color + 64*endPiece + endSq];
+
+        if (isEP(m))
+            key ^= zobristTable[384*(color^1) + epVictimSquare(color^1, epCaptureFile)];
+        else if (isCapture(m))
+            key ^= zobristTable[384*(color^1) + 64*getPieceOnSquare(color^1, endSq) + endSq];
+
+        if (getFlags(m) == MOVE_DOUBLE_PAWN)
+            newEPCaptureFile = startSq & 7;
+    }
+
+    // Castling rights are lost when the king moves, or when a rook leaves or
+    // is captured on its starting square
+    if (pieceID == KINGS)
+        newCastlingRights &= (color == WHITE) ? ~WHITECASTLE : ~BLACKCASTLE;
+    if (startSq == 7 || endSq == 7)
+        newCastlingRights &= ~WHITEKSIDE;
+    if (startSq == 0 || endSq == 0)
+        newCastlingRights &= ~WHITEQSIDE;
+    if (startSq == 63 || endSq == 63)
+        newCastlingRights &= ~BLACKKSIDE;
+    if (startSq == 56 || endSq == 56)
+        newCastlingRights &= ~BLACKQSIDE;
+
+    key ^= zobristTable[769 + newCastlingRights];
+    key ^= zobristTable[785 + newEPCaptureFile];
+    return key;
+}
+
 //------------------------------------------------------------------------------
 //-------------------------------Move Generation--------------------------------
 //------------------------------------------------------------------------------
 /*
- * @brief Returns a list of structs containing the piece type, start square,
+ * @brief Fills a list of structs containing the piece type, start square,
  * and a bitboard of potential legal moves for each knight, bishop, rook, and queen.
  * Used for mobility evaluation of pieces.
  */
-PieceMoveList Board::getPieceMoveList(int color) const {
-    PieceMoveList pml;
+void Board::getPieceMoveList(PieceMoveList &pml, int color) const {
+    pml.length = 0;
 
     uint64_t knights = pieces[color][KNIGHTS];
     while (knights) {
@@ -440,26 +949,253 @@ PieceMoveList Board::getPieceMoveList(int color) const {
 
         pml.add(PieceMoveInfo(QUEENS, stSq, qSq));
     }
+}
+
+#ifdef HAS_AVX2_ATTACKS
+// A batch of sliders for the AVX2 attack code: the start square bitboard and
+// the empty squares each slider sees, one 64-bit lane per slider. The batch is
+// padded with empty lanes to a multiple of four.
+struct SliderBatch {
+    uint64_t from[24];
+    uint64_t empty[24];
+    uint64_t attacks[24];
+    int length;
+};
 
-    return pml;
+template <int shift, bool left>
+__attribute__((target("avx2")))
+static inline __m256i shiftLanes(__m256i x) {
+    return left ? _mm256_slli_epi64(x, shift) : _mm256_srli_epi64(x, shift);
 }
 
+/*
+ * Kogge-Stone occluded fill in one direction for four sliders at once.
+ * The wrap mask removes the squares that a shift would wrap onto from the
+ * other side of the board.
+ * https://chessprogramming.wikispaces.com/Kogge-Stone+Algorithm
+ */
+template <int shift, bool left>
+__attribute__((target("avx2")))
+static inline __m256i slideAttacks(__m256i gen, __m256i pro, __m256i wrap) {
+    pro = _mm256_and_si256(pro, wrap);
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shiftLanes<shift, left>(gen)));
+    pro = _mm256_and_si256(pro, shiftLanes<shift, left>(pro));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shiftLanes<2*shift, left>(gen)));
+    pro = _mm256_and_si256(pro, shiftLanes<2*shift, left>(pro));
+    gen = _mm256_or_si256(gen, _mm256_and_si256(pro, shiftLanes<4*shift, left>(gen)));
+    return _mm256_and_si256(shiftLanes<shift, left>(gen), wrap);
+}
+
+// Computes the attack sets of every slider in the batch along the diagonals
+// or along the ranks and files.
+template <bool diagonal>
+__attribute__((target("avx2")))
+static void batchSliderAttacks(SliderBatch &batch) {
+    const __m256i notA = _mm256_set1_epi64x((long long) NOTA);
+    const __m256i notH = _mm256_set1_epi64x((long long) NOTH);
+    const __m256i all = _mm256_set1_epi64x(-1LL);
+
+    for (int i = 0; i < batch.length; i += 4) {
+        __m256i gen = _mm256_loadu_si256((const __m256i *) (batch.from + i));
+        __m256i pro = _mm256_loadu_si256((const __m256i *) (batch.empty + i));
+        __m256i attacks;
+        if (diagonal) {
+            attacks = _mm256_or_si256(
+                _mm256_or_si256(slideAttacks<9, true>(gen, pro, notA),
+                                slideAttacks<7, true>(gen, pro, notH)),
+                _mm256_or_si256(slideAttacks<7, false>(gen, pro, notA),
+                                slideAttacks<9, false>(gen, pro, notH)));
+        }
+        else {
+            attacks = _mm256_or_si256(
+                _mm256_or_si256(slideAttacks<8, true>(gen, pro, all),
+                                slideAttacks<8, false>(gen, pro, all)),
+                _mm256_or_si256(slideAttacks<1, true>(gen, pro, notA),
+                                slideAttacks<1, false>(gen, pro, notH)));
+        }
+        _mm256_storeu_si256((__m256i *) (batch.attacks + i), attacks);
+    }
+}
+
+static inline void addToBatch(SliderBatch &batch, uint64_t pieces, uint64_t occ) {
+    while (pieces) {
+        batch.from[batch.length] = pieces & -pieces;
+        batch.empty[batch.length] = ~occ;
+        batch.length++;
+        pieces &= pieces-1;
+    }
+}
+
+static inline void padBatch(SliderBatch &batch) {
+    while (batch.length & 3) {
+        batch.from[batch.length] = 0;
+        batch.empty[batch.length] = 0;
+        batch.length++;
+    }
+}
+#endif
+
+/*
+ * @brief Fills the piece move lists of both sides, indexed by color. The
+ * lists are identical to the ones from getPieceMoveList(). With AVX2, the
+ * slider attacks of both sides are computed together in two batches, one
+ * for the diagonal and one for the orthogonal directions.
+ */
+void Board::getPieceMoveLists(PieceMoveList *pml) const {
+#ifdef HAS_AVX2_ATTACKS
+    if (useAvx2) {
+        SliderBatch diag, orth;
+        diag.length = 0;
+        orth.length = 0;
+        // Lane offsets of each side's bishops, rooks, and queens in the batches
+        int diagStart[2], orthStart[2];
+        for (int color = WHITE; color <= BLACK; color++) {
+            uint64_t occ = allPieces[color^1] | pieces[color][PAWNS] | pieces[color][KNIGHTS] | pieces[color][KINGS];
+            diagStart[color] = diag.length;
+            addToBatch(diag, pieces[color][BISHOPS], occ | pieces[color][ROOKS]);
+            addToBatch(diag, pieces[color][QUEENS], occ);
+            orthStart[color] = orth.length;
+            addToBatch(orth, pieces[color][ROOKS], occ | pieces[color][BISHOPS]);
+            addToBatch(orth, pieces[color][QUEENS], occ);
+        }
+        padBatch(diag);
+        padBatch(orth);
+        batchSliderAttacks<true>(diag);
+        batchSliderAttacks<false>(orth);
+
+        for (int color = WHITE; color <= BLACK; color++) {
+            PieceMoveList &list = pml[color];
+            list.length = 0;
+
+            uint64_t knights = pieces[color][KNIGHTS];
+            while (knights) {
+                int stSq = bitScanForward(knights);
+                knights &= knights-1;
+                list.add(PieceMoveInfo(KNIGHTS, stSq, getKnightSquares(stSq)));
+            }
+
+            int d = diagStart[color];
+            int o = orthStart[color];
+            list.starts[BISHOPS] = list.size();
+            uint64_t bishops = pieces[color][BISHOPS];
+            while (bishops) {
+                int stSq = bitScanForward(bishops);
+                bishops &= bishops-1;
+                list.add(PieceMoveInfo(BISHOPS, stSq, diag.attacks[d++]));
+            }
+
+            list.starts[ROOKS] = list.size();
+            uint64_t rooks = pieces[color][ROOKS];
+            while (rooks) {
+                int stSq = bitScanForward(rooks);
+                rooks &= rooks-1;
+                list.add(PieceMoveInfo(ROOKS, stSq, orth.attacks[o++]));
+            }
+
+            list.starts[QUEENS] = list.size();
+            uint64_t queens = pieces[color][QUEENS];
+            while (queens) {
+                int stSq = bitScanForward(queens);
+                queens &= queens-1;
+                list.add(PieceMoveInfo(QUEENS, stSq, diag.attacks[d++] | orth.attacks[o++]));
+            }
+        }
+        return;
+    }
+#endif
+
+    getPieceMoveList(pml[WHITE], WHITE);
+    getPieceMoveList(pml[BLACK], BLACK);
+}
+
+//--------------------------------Legal Moves-----------------------------------
 // Get all legal moves and captures
 MoveList Board::getAllLegalMoves(int color) const {
     MoveList moves;
+    getLegalMoves(moves, color);
+    return moves;
+}
+
+// Legal moves are generated in the same order as getAllPseudoLegalMoves()
+void Board::getLegalMoves(MoveList &moves, int color) const {
     getAllPseudoLegalMoves(moves, color);
+    removeIllegalMoves(moves, color);
+}
 
-    for (unsigned int i = 0; i < moves.size(); i++) {
-        Board b = staticCopy();
-        b.doMove(moves.get(i), color);
+// Legal moves when the side to move is in check, in the same order as
+// getPseudoLegalCheckEscapes()
+void Board::getLegalCheckEscapes(MoveList &escapes, int color) const {
+    getPseudoLegalCheckEscapes(escapes, color);
+    removeIllegalMoves(escapes, color);
+}
 
-        if (b.isInCheck(color)) {
-            moves.remove(i);
-            i--;
-        }
+/*
+ * Removes the moves that would leave the king in check from a list of
+ * pseudo-legal moves, without making any of them. The order of the remaining
+ * moves is kept.
+ * The king cannot move to an attacked square. When in check, other moves must
+ * capture the checker or block it (the check mask), and a pinned piece can
+ * only move along the ray between the king and its pinner.
+ */
+void Board::removeIllegalMoves(MoveList &moves, int color) const {
+    int kingSq = kingSqs[color];
+    uint64_t occ = getOccupancy();
+    uint64_t checkers = getAttackMap(color^1, kingSq);
+    uint64_t checkMask = ~0ULL;
+    if (checkers) {
+        // In double check, only the king can move
+        checkMask = (checkers & (checkers - 1)) ? 0
+                  : checkers | inBetweenSqs[bitScanForward(checkers)][kingSq];
     }
 
-    return moves;
+    // Find pinned pieces as in getPinnedMap(), recording the squares each one
+    // can still move to
+    uint64_t pinned = 0;
+    uint64_t pinRays[64];
+    uint64_t pinners = (getRookXRays(kingSq, occ, allPieces[color])
+                        & (pieces[color^1][ROOKS] | pieces[color^1][QUEENS]))
+                     | (getBishopXRays(kingSq, occ, allPieces[color])
+                        & (pieces[color^1][BISHOPS] | pieces[color^1][QUEENS]));
+    while (pinners) {
+        int pinnerSq = bitScanForward(pinners);
+        pinners &= pinners - 1;
+        uint64_t ray = inBetweenSqs[pinnerSq][kingSq];
+        int pinnedSq = bitScanForward(ray & allPieces[color]);
+        pinned |= indexToBit(pinnedSq);
+        pinRays[pinnedSq] = ray | indexToBit(pinnerSq);
+    }
+
+    unsigned int legalCount = 0;
+    for (unsigned int i = 0; i < moves.size(); i++) {
+        Move m = moves.get(i);
+        int startSq = getStartSq(m);
+        uint64_t endSingle = indexToBit(getEndSq(m));
+        bool isLegal;
+
+        if (startSq == kingSq) {
+            // Remove the king so that it does not block sliders attacking the
+            // squares behind it. Castling passthrough squares were already
+            // checked when the move was generated.
+            isLegal = !(getAttackMap(getEndSq(m), occ ^ indexToBit(kingSq)) & allPieces[color^1]);
+        }
+        else if (isEP(m)) {
+            // En passant removes two pieces from a rank, so look for sliders
+            // directly
+            uint64_t victim = indexToBit(epVictimSquare(color^1, epCaptureFile));
+            uint64_t epOcc = (occ ^ indexToBit(startSq) ^ victim) | endSingle;
+            isLegal = !((getRookSquares(kingSq, epOcc) & (pieces[color^1][ROOKS] | pieces[color^1][QUEENS]))
+                      | (getBishopSquares(kingSq, epOcc) & (pieces[color^1][BISHOPS] | pieces[color^1][QUEENS]))
+                      | (checkers & ~victim & (pieces[color^1][KNIGHTS] | pieces[color^1][PAWNS])));
+        }
+        else {
+            isLegal = (endSingle & checkMask)
+                   && (!(pinned & indexToBit(startSq)) || (endSingle & pinRays[startSq]));
+        }
+
+        if (isLegal)
+            moves.set(legalCount++, m);
+    }
+    moves.resize(legalCount);
 }
 
 //------------------------------Pseudo-legal Moves------------------------------
@@ -485,11 +1221,19 @@ void Board::getAllPseudoLegalMoves(MoveList &legalMoves, int color) const {
  * King moves
  */
 void Board::getPseudoLegalQuiets(MoveList &quiets, int color) const {
-    addCastlesToList(quiets, color);
+    if (color == WHITE)
+        getPseudoLegalQuiets<WHITE>(quiets);
+    else
+        getPseudoLegalQuiets<BLACK>(quiets);
+}
+
+template <int color>
+void Board::getPseudoLegalQuiets(MoveList &quiets) const {
+    addCastlesToList<color>(quiets);
 
-    addPieceMovesToList<MOVEGEN_QUIETS>(quiets, color);
+    addPieceMovesToList<color, MOVEGEN_QUIETS>(quiets);
 
-    addPawnMovesToList(quiets, color);
+    addPawnMovesToList<color>(quiets);
 
     uint64_t kingMoves = getKingSquares(kingSqs[color]);
     addMovesToList<MOVEGEN_QUIETS>(quiets, kingSqs[color], kingMoves);
@@ -506,14 +1250,22 @@ void Board::getPseudoLegalQuiets(MoveList &quiets, int color) const {
  * Queen captures
  */
 void Board::getPseudoLegalCaptures(MoveList &captures, int color, bool includePromotions) const {
+    if (color == WHITE)
+        getPseudoLegalCaptures<WHITE>(captures, includePromotions);
+    else
+        getPseudoLegalCaptures<BLACK>(captures, includePromotions);
+}
+
+template <int color>
+void Board::getPseudoLegalCaptures(MoveList &captures, bool includePromotions) const {
     uint64_t otherPieces = allPieces[color^1];
 
     uint64_t kingMoves = getKingSquares(kingSqs[color]);
     addMovesToList<MOVEGEN_CAPTURES>(captures, kingSqs[color], kingMoves, otherPieces);
 
-    addPawnCapturesToList(captures, color, otherPieces, includePromotions);
+    addPawnCapturesToList<color>(captures, otherPieces, includePromotions);
 
-    addPieceMovesToList<MOVEGEN_CAPTURES>(captures, color, otherPieces);
+    addPieceMovesToList<color, MOVEGEN_CAPTURES>(captures, otherPieces);
 }
 
 // Generates all queen promotions for quiescence search
@@ -707,9 +1459,17 @@ void Board::getPseudoLegalChecks(MoveList &checks, int color) const {
 // Optimizations include looking for double check (king moves only),
 // otherwise we can only capture the checker or block if it is an xray piece
 void Board::getPseudoLegalCheckEscapes(MoveList &escapes, int color) const {
+    if (color == WHITE)
+        getPseudoLegalCheckEscapes<WHITE>(escapes);
+    else
+        getPseudoLegalCheckEscapes<BLACK>(escapes);
+}
+
+template <int color>
+void Board::getPseudoLegalCheckEscapes(MoveList &escapes) const {
     int kingSq = kingSqs[color];
     uint64_t otherPieces = allPieces[color^1];
-    uint64_t attackMap = getAttackMap(color^1, kingSq);
+    uint64_t attackMap = getAttackMap<color^1>(kingSq);
     // Consider only captures of pieces giving check
     otherPieces &= attackMap;
 
@@ -722,7 +1482,7 @@ void Board::getPseudoLegalCheckEscapes(MoveList &escapes, int color) const {
         return;
     }
 
-    addPawnCapturesToList(escapes, color, otherPieces, true);
+    addPawnCapturesToList<color>(escapes, otherPieces, true);
 
     uint64_t occ = getOccupancy();
     // If bishops, rooks, or queens, get bitboard of attack path so we
@@ -737,12 +1497,12 @@ void Board::getPseudoLegalCheckEscapes(MoveList &escapes, int color) const {
     else if (attackerType == QUEENS)
         xraySqs = getQueenSquares(attackerSq, occ);
 
-    addPieceMovesToList<MOVEGEN_CAPTURES>(escapes, color, otherPieces);
+    addPieceMovesToList<color, MOVEGEN_CAPTURES>(escapes, otherPieces);
 
     uint64_t kingMoves = getKingSquares(kingSqs[color]);
     addMovesToList<MOVEGEN_CAPTURES>(escapes, kingSqs[color], kingMoves, allPieces[color^1]);
 
-    addPawnMovesToList(escapes, color);
+    addPawnMovesToList<color>(escapes);
     uint64_t knights = pieces[color][KNIGHTS];
     while (knights) {
         int stSq = bitScanForward(knights);
@@ -787,7 +1547,8 @@ void Board::getPseudoLegalCheckEscapes(MoveList &escapes, int color) const {
 //------------------------------------------------------------------------------
 // We can do pawns in parallel, since the start square of a pawn move is
 // determined by its end square.
-void Board::addPawnMovesToList(MoveList &quiets, int color) const {
+template <int color>
+void Board::addPawnMovesToList(MoveList &quiets) const {
     uint64_t pawns = pieces[color][PAWNS];
     uint64_t finalRank = (color == WHITE) ? RANK_8 : RANK_1;
     int sqDiff = (color == WHITE) ? -8 : 8;
@@ -825,7 +1586,8 @@ void Board::addPawnMovesToList(MoveList &quiets, int color) const {
 // For pawn captures, we can use a similar approach, but we must consider
 // left-hand and right-hand captures separately so we can tell which
 // pawn is doing the capturing.
-void Board::addPawnCapturesToList(MoveList &captures, int color, uint64_t otherPieces, bool includePromotions) const {
+template <int color>
+void Board::addPawnCapturesToList(MoveList &captures, uint64_t otherPieces, bool includePromotions) const {
     uint64_t pawns = pieces[color][PAWNS];
     uint64_t finalRank = (color == WHITE) ? RANK_8 : RANK_1;
     int leftDiff = (color == WHITE) ? -7 : 9;
@@ -895,8 +1657,8 @@ void Board::addPawnCapturesToList(MoveList &captures, int color, uint64_t otherP
     }
 }
 
-template <bool isCapture>
-void Board::addPieceMovesToList(MoveList &moves, int color, uint64_t otherPieces) const {
+template <int color, bool isCapture>
+void Board::addPieceMovesToList(MoveList &moves, uint64_t otherPieces) const {
     uint64_t knights = pieces[color][KNIGHTS];
     while (knights) {
         int stSq = bitScanForward(knights);
@@ -975,49 +1737,36 @@ void Board::addPromotionsToList(MoveList &moves, int stSq, int endSq) const {
     moves.add(mb);
 }
 
-void Board::addCastlesToList(MoveList &moves, int color) const {
-    // Add all possible castles
-    if (color == WHITE) {
-        // If castling rights still exist, squares in between king and rook are
-        // empty, and player is not in check
-        if ((castlingRights & WHITEKSIDE)
-         && (getOccupancy() & WHITE_KSIDE_PASSTHROUGH_SQS) == 0
-         && !isInCheck(WHITE)) {
-            // Check for castling through check
-            if (getAttackMap(BLACK, 5) == 0) {
-                Move m = encodeMove(4, 6);
-                m = setCastle(m, true);
-                moves.add(m);
-            }
-        }
-        if ((castlingRights & WHITEQSIDE)
-         && (getOccupancy() & WHITE_QSIDE_PASSTHROUGH_SQS) == 0
-         && !isInCheck(WHITE)) {
-            if (getAttackMap(BLACK, 3) == 0) {
-                Move m = encodeMove(4, 2);
-                m = setCastle(m, true);
-                moves.add(m);
-            }
+template <int color>
+void Board::addCastlesToList(MoveList &moves) const {
+    constexpr uint8_t KSIDE_RIGHTS = (color == WHITE) ? WHITEKSIDE : BLACKKSIDE;
+    constexpr uint8_t QSIDE_RIGHTS = (color == WHITE) ? WHITEQSIDE : BLACKQSIDE;
+    constexpr uint64_t KSIDE_PASSTHROUGH_SQS = (color == WHITE) ? WHITE_KSIDE_PASSTHROUGH_SQS
+                                                                : BLACK_KSIDE_PASSTHROUGH_SQS;
+    constexpr uint64_t QSIDE_PASSTHROUGH_SQS = (color == WHITE) ? WHITE_QSIDE_PASSTHROUGH_SQS
+                                                                : BLACK_QSIDE_PASSTHROUGH_SQS;
+    // The king's square, relative to which the other squares are given
+    constexpr int KING_SQ = (color == WHITE) ? 4 : 60;
+
+    // If castling rights still exist, squares in between king and rook are
+    // empty, and player is not in check
+    if ((castlingRights & KSIDE_RIGHTS)
+     && (getOccupancy() & KSIDE_PASSTHROUGH_SQS) == 0
+     && !isInCheck<color>()) {
+        // Check for castling through check
+        if (getAttackMap<color^1>(KING_SQ + 1) == 0) {
+            Move m = encodeMove(KING_SQ, KING_SQ + 2);
+            m = setCastle(m, true);
+            moves.add(m);
         }
     }
-    else {
-        if ((castlingRights & BLACKKSIDE)
-         && (getOccupancy() & BLACK_KSIDE_PASSTHROUGH_SQS) == 0
-         && !isInCheck(BLACK)) {
-            if (getAttackMap(WHITE, 61) == 0) {
-                Move m = encodeMove(60, 62);
-                m = setCastle(m, true);
-                moves.add(m);
-            }
-        }
-        if ((castlingRights & BLACKQSIDE)
-         && (getOccupancy() & BLACK_QSIDE_PASSTHROUGH_SQS) == 0
-         && !isInCheck(BLACK)) {
-            if (getAttackMap(WHITE, 59) == 0) {
-                Move m = encodeMove(60, 58);
-                m = setCastle(m, true);
-                moves.add(m);
-            }
+    if ((castlingRights & QSIDE_RIGHTS)
+     && (getOccupancy() & QSIDE_PASSTHROUGH_SQS) == 0
+     && !isInCheck<color>()) {
+        if (getAttackMap<color^1>(KING_SQ - 1) == 0) {
+            Move m = encodeMove(KING_SQ, KING_SQ - 2);
+            m = setCastle(m, true);
+            moves.add(m);
         }
     }
 }
@@ -1044,6 +1793,11 @@ uint64_t Board::getXRayPieceMap(int color, int sq, uint64_t occ) const {
 // Given a color and a square, returns all pieces of the color that attack the
 // square. Useful for checks, captures
 uint64_t Board::getAttackMap(int color, int sq) const {
+    return (color == WHITE) ? getAttackMap<WHITE>(sq) : getAttackMap<BLACK>(sq);
+}
+
+template <int color>
+uint64_t Board::getAttackMap(int sq) const {
     uint64_t occ = getOccupancy();
     uint64_t pawnCap = (color == WHITE)
                      ? getBPawnCaptures(indexToBit(sq))
@@ -1067,14 +1821,11 @@ uint64_t Board::getAttackMap(int sq, uint64_t occ) const {
 
 // Returns the piece with given color on the given square, if any
 int Board::getPieceOnSquare(int color, int sq) const {
-    uint64_t endSingle = indexToBit(sq);
-    for (int pieceID = 0; pieceID <= 5; pieceID++) {
-        if (pieces[color][pieceID] & endSingle)
-            return pieceID;
-    }
+    // Empty squares and pieces of the other color fall outside of 0-5
+    int pieceID = mailbox[sq] - 6*color;
     // If used for captures, the default of an empty square indicates an
     // en passant (and hopefully not an error).
-    return -1;
+    return ((unsigned) pieceID <= KINGS) ? pieceID : -1;
 }
 
 // Returns true if a move puts the opponent in check
@@ -1201,7 +1952,12 @@ uint64_t Board::getPinnedMap(int color) const {
 //-------------------King: check, draw, insufficient material-------------------
 //------------------------------------------------------------------------------
 bool Board::isInCheck(int color) const {
-    return getAttackMap(color^1, kingSqs[color]);
+    return (color == WHITE) ? isInCheck<WHITE>() : isInCheck<BLACK>();
+}
+
+template <int color>
+bool Board::isInCheck() const {
+    return getAttackMap<color^1>(kingSqs[color]);
 }
 
 bool Board::isDraw() const {
@@ -1402,7 +2158,9 @@ uint64_t Board::getKnightSquares(int single) const {
 }
 
 uint64_t Board::getBishopSquares(int single, uint64_t occ) const {
-    uint64_t *attTableLoc = magicBishops[single].table;
+    if (usePext)
+        return magicBishops[single].table[pext(occ, magicBishops[single].mask)];
+    const uint64_t *attTableLoc = magicBishops[single].table;
     occ &= magicBishops[single].mask;
     occ *= magicBishops[single].magic;
     occ >>= magicBishops[single].shift;
@@ -1410,7 +2168,9 @@ uint64_t Board::getBishopSquares(int single, uint64_t occ) const {
 }
 
 uint64_t Board::getRookSquares(int single, uint64_t occ) const {
-    uint64_t *attTableLoc = magicRooks[single].table;
+    if (usePext)
+        return magicRooks[single].table[pext(occ, magicRooks[single].mask)];
+    const uint64_t *attTableLoc = magicRooks[single].table;
     occ &= magicRooks[single].mask;
     occ *= magicRooks[single].magic;
     occ >>= magicRooks[single].shift;
@@ -1489,37 +2249,41 @@ int Board::getKingSq(int color) const {
     return kingSqs[color];
 }
 
-int *Board::getMailbox() const {
-    int *result = new int[64];
-    for (int i = 0; i < 64; i++) {
-        result[i] = -1;
-    }
-    for (int i = 0; i < 6; i++) {
-        uint64_t bitboard = pieces[WHITE][i];
-        while (bitboard) {
-            result[bitScanForward(bitboard)] = i;
-            bitboard &= bitboard - 1;
-        }
-    }
-    for (int i = 0; i < 6; i++) {
-        uint64_t bitboard = pieces[BLACK][i];
-        while (bitboard) {
-            result[bitScanForward(bitboard)] = 6 + i;
-            bitboard &= bitboard - 1;
-        }
-    }
-    return result;
+const int8_t *Board::getMailbox() const {
+    return mailbox;
 }
 
 uint64_t Board::getZobristKey() const {
     return zobristKey;
 }
 
-void Board::initZobristKey(int *mailbox) {
+uint64_t Board::getPawnZobristKey() const {
+    return pawnZobristKey;
+}
+
+uint64_t Board::getMaterialZobristKey() const {
+    return materialZobristKey;
+}
+
+Score Board::getPsqtScore(int color) const {
+    return psqtScores[color];
+}
+
+void Board::initZobristKey() {
     zobristKey = 0;
+    pawnZobristKey = 0;
     for (int i = 0; i < 64; i++) {
         if (mailbox[i] != -1) {
             zobristKey ^= zobristTable[mailbox[i] * 64 + i];
+            if (mailbox[i] % 6 == PAWNS)
+                pawnZobristKey ^= zobristTable[mailbox[i] * 64 + i];
+        }
+    }
+    materialZobristKey = 0;
+    for (int color = WHITE; color <= BLACK; color++) {
+        for (int pieceID = PAWNS; pieceID <= QUEENS; pieceID++) {
+            for (int n = 0; n < count(pieces[color][pieceID]); n++)
+                materialZobristKey ^= materialKey(color, pieceID, n);
         }
     }
     if (playerToMove == BLACK)
@@ -1527,3 +2291,16 @@ void Board::initZobristKey(int *mailbox) {
     zobristKey ^= zobristTable[769 + castlingRights];
     zobristKey ^= zobristTable[785 + epCaptureFile];
 }
+
+void Board::initPsqtScores() {
+    for (int color = WHITE; color <= BLACK; color++) {
+        psqtScores[color] = EVAL_ZERO;
+        for (int pieceID = PAWNS; pieceID <= KINGS; pieceID++) {
+            uint64_t bitboard = pieces[color][pieceID];
+            while (bitboard) {
+                psqtScores[color] += PSQT[color][pieceID][bitScanForward(bitboard)];
+                bitboard &= bitboard - 1;
+            }
+        }
+    }
+}
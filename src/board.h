@@ -35,6 +35,20 @@ constexpr bool MOVEGEN_CAPTURES = true;
 constexpr bool MOVEGEN_QUIETS = false;
 
 
+// The part of the board state that cannot be recovered from a move alone,
+// saved by doMove so that undoMove can restore the position
+struct UndoInfo {
+    uint64_t zobristKey;
+    uint64_t pawnZobristKey;
+    uint64_t materialZobristKey;
+    Score psqtScores[2];
+    // The captured piece ID, or -1 for a quiet move or en passant
+    int capturedPiece;
+    uint16_t epCaptureFile;
+    uint8_t castlingRights;
+    uint8_t fiftyMoveCounter;
+};
+
 struct PieceMoveInfo {
     int pieceID;
     int startSq;
@@ -68,7 +82,7 @@ struct PieceMoveList {
     PieceMoveInfo get(int i) { return arrayList[i]; }
 };
 
-void initZobristTable();
+void initStartPosKeys();
 
 
 /**
@@ -85,13 +99,23 @@ public:
     Board staticCopy() const;
 
     void doMove(Move m, int color);
+    void doMove(Move m, int color, UndoInfo &undo);
     bool doPseudoLegalMove(Move m, int color);
-    bool doHashMove(Move m, int color);
+    bool doPseudoLegalMove(Move m, int color, UndoInfo &undo);
+    bool doHashMove(Move m, int color, UndoInfo &undo);
+    bool isPseudoLegal(Move m, int color) const;
+    void undoMove(Move m, const UndoInfo &undo);
     void doNullMove();
     void undoNullMove(uint16_t _epCaptureFile);
+    // Zobrist key of the position after a pseudo-legal move m, without doing it
+    uint64_t getZobristKeyAfterMove(Move m, int color) const;
 
-    PieceMoveList getPieceMoveList(int color) const;
+    void getPieceMoveList(PieceMoveList &pml, int color) const;
+    void getPieceMoveLists(PieceMoveList *pml) const;
     MoveList getAllLegalMoves(int color) const;
+    void getLegalMoves(MoveList &moves, int color) const;
+    void getLegalCheckEscapes(MoveList &escapes, int color) const;
+    void removeIllegalMoves(MoveList &moves, int color) const;
     void getAllPseudoLegalMoves(MoveList &legalMoves, int color) const;
     void getPseudoLegalQuiets(MoveList &quiets, int color) const;
     void getPseudoLegalCaptures(MoveList &captures, int color, bool includePromotions) const;
@@ -145,10 +169,14 @@ public:
     uint64_t getPieces(int color, int piece) const;
     uint64_t getAllPieces(int color) const;
     int getKingSq(int color) const;
-    int *getMailbox() const;
+    const int8_t *getMailbox() const;
     uint64_t getZobristKey() const;
+    uint64_t getPawnZobristKey() const;
+    uint64_t getMaterialZobristKey() const;
+    Score getPsqtScore(int color) const;
 
-    void initZobristKey(int *mailbox);
+    void initZobristKey();
+    void initPsqtScores();
 
 private:
     // Bitboards for all white or all black pieces
@@ -156,8 +184,17 @@ private:
     // 12 bitboards, one for each of the 12 piece types, indexed by the
     // constants given in common.h
     uint64_t pieces[2][6];
+    // The piece on each square as 6 * color + pieceID, or -1 if empty
+    int8_t mailbox[64];
     // Zobrist key for hash table use
     uint64_t zobristKey;
+    // Zobrist key of the pawns only, for the pawn hash table
+    uint64_t pawnZobristKey;
+    // Zobrist key of the number of each piece, for the material hash table
+    uint64_t materialZobristKey;
+    // Sum of the packed piece square table scores of each side's pieces,
+    // starting from EVAL_ZERO
+    Score psqtScores[2];
     // 8 if cannot en passant, if en passant is possible, the file of the
     // pawn being captured is stored here (0-7)
     uint16_t epCaptureFile;
@@ -177,15 +214,33 @@ private:
     // Precomputed tables
     int kingSqs[2];
 
-    void addPawnMovesToList(MoveList &quiets, int color) const;
-    void addPawnCapturesToList(MoveList &captures, int color, uint64_t otherPieces, bool includePromotions) const;
-    template <bool isCapture>
-    void addPieceMovesToList(MoveList &moves, int color, uint64_t otherPieces = 0) const;
+    // Color-templated versions of the hot paths. The public functions taking
+    // a color dispatch to these once per call.
+    template <int color>
+    void doMove(Move m);
+    template <int color>
+    void getPseudoLegalQuiets(MoveList &quiets) const;
+    template <int color>
+    void getPseudoLegalCaptures(MoveList &captures, bool includePromotions) const;
+    template <int color>
+    void getPseudoLegalCheckEscapes(MoveList &escapes) const;
+    template <int color>
+    uint64_t getAttackMap(int sq) const;
+    template <int color>
+    bool isInCheck() const;
+
+    template <int color>
+    void addPawnMovesToList(MoveList &quiets) const;
+    template <int color>
+    void addPawnCapturesToList(MoveList &captures, uint64_t otherPieces, bool includePromotions) const;
+    template <int color, bool isCapture>
+    void addPieceMovesToList(MoveList &moves, uint64_t otherPieces = 0) const;
     template <bool isCapture>
     void addMovesToList(MoveList &moves, int stSq, uint64_t allEndSqs, uint64_t otherPieces = 0) const;
     template <bool isCapture>
     void addPromotionsToList(MoveList &moves, int stSq, int endSq) const;
-    void addCastlesToList(MoveList &moves, int color) const;
+    template <int color>
+    void addCastlesToList(MoveList &moves) const;
 
     // Move generation
     // Takes into account blocking for sliders, but otherwise leaves
@@ -60,6 +60,25 @@ inline int relativeRank(int c, int r) {
     return (r ^ (7 * c));
 }
 
+// Compile-time lists of the integers 0 to N-1, used to fill constant tables by
+// expanding the list into calls to a constexpr function (C++11 has no
+// std::index_sequence). The list is built by halves to keep the template
+// recursion shallow.
+template <int... Is> struct IndexList {};
+
+template <class A, class B> struct ConcatIndexLists;
+template <int... As, int... Bs>
+struct ConcatIndexLists<IndexList<As...>, IndexList<Bs...>> {
+    typedef IndexList<As..., (int) sizeof...(As) + Bs...> type;
+};
+
+template <int N> struct MakeIndexList {
+    typedef typename ConcatIndexLists<typename MakeIndexList<N/2>::type,
+        typename MakeIndexList<N - N/2>::type>::type type;
+};
+template <> struct MakeIndexList<0> { typedef IndexList<> type; };
+template <> struct MakeIndexList<1> { typedef IndexList<0> type; };
+
 
 /*
  * Moves are represented as an unsigned 16-bit integer.
@@ -72,6 +91,10 @@ inline int relativeRank(int c, int r) {
  */
 typedef uint16_t Move;
 
+// Eval scores are packed into an unsigned 32-bit integer during calculations
+// (the SWAR technique)
+typedef uint32_t Score;
+
 constexpr Move NULL_MOVE = 0;
 constexpr uint16_t MOVE_DOUBLE_PAWN = 0x1;
 constexpr uint16_t MOVE_EP = 0x5;
@@ -37,9 +37,36 @@ constexpr uint64_t KING_DEFENSE_ZONE[8] = {
     FILE_D | FILE_E, KSIDE ^ FILE_E, KSIDE ^ FILE_E, KSIDE ^ FILE_E
 };
 
-Score PSQT[2][6][64];
-Score MOBILITY[5][28];
-char manhattanDistance[64][64], kingDistance[64][64];
+constexpr int rankDistance(int sq1, int sq2) {
+    return ((sq1 >> 3) > (sq2 >> 3)) ? (sq1 >> 3) - (sq2 >> 3) : (sq2 >> 3) - (sq1 >> 3);
+}
+
+constexpr int fileDistance(int sq1, int sq2) {
+    return ((sq1 & 7) > (sq2 & 7)) ? (sq1 & 7) - (sq2 & 7) : (sq2 & 7) - (sq1 & 7);
+}
+
+constexpr char manhattanDist(int sq1, int sq2) {
+    return (char) (rankDistance(sq1, sq2) + fileDistance(sq1, sq2));
+}
+
+// The number of king moves between the squares, capped at 5
+constexpr char kingDist(int sq1, int sq2) {
+    return (char) ((rankDistance(sq1, sq2) >= 5 || fileDistance(sq1, sq2) >= 5) ? 5
+        : (rankDistance(sq1, sq2) > fileDistance(sq1, sq2)) ? rankDistance(sq1, sq2)
+        : fileDistance(sq1, sq2));
+}
+
+template <class Indices> struct DistanceTables;
+template <int... Is> struct DistanceTables<IndexList<Is...>> {
+    static constexpr char manhattan[64][64] = {manhattanDist(Is / 64, Is % 64)...};
+    static constexpr char king[64][64] = {kingDist(Is / 64, Is % 64)...};
+};
+template <int... Is> constexpr char DistanceTables<IndexList<Is...>>::manhattan[64][64];
+template <int... Is> constexpr char DistanceTables<IndexList<Is...>>::king[64][64];
+
+typedef DistanceTables<MakeIndexList<64 * 64>::type> Distances;
+constexpr const char (&manhattanDistance)[64][64] = Distances::manhattan;
+constexpr const char (&kingDistance)[64][64] = Distances::king;
 
 struct EvalDebug {
     int totalEval;
@@ -150,38 +177,6 @@ EvalDebug evalDebugStats;
 } // namespace
 
 
-void initEvalTables() {
-    #define E(mg, eg) ((Score) ((((int32_t) eg) << 16) + ((int32_t) mg)))
-    for (int pieceType = PAWNS; pieceType <= KINGS; pieceType++) {
-        for (int sq = 0; sq < 32; sq++) {
-            int r = sq / 4;
-            int f = sq & 0x3;
-            Score sc = E(pieceSquareTable[MG][pieceType][sq], pieceSquareTable[EG][pieceType][sq]);
-
-            PSQT[WHITE][pieceType][8*(7-r) + f] = sc;
-            PSQT[WHITE][pieceType][8*(7-r) + (7-f)] = sc;
-            PSQT[BLACK][pieceType][8*r + f] = sc;
-            PSQT[BLACK][pieceType][8*r + (7-f)] = sc;
-        }
-    }
-    for (int pieceID = 0; pieceID < 5; pieceID++) {
-        for (int sqs = 0; sqs < 28; sqs++)
-            MOBILITY[pieceID][sqs] = E(mobilityTable[MG][pieceID][sqs], mobilityTable[EG][pieceID][sqs]);
-    }
-    #undef E
-}
-
-void initDistances() {
-    for (int sq1 = 0; sq1 < 64; sq1++) {
-        for (int sq2 = 0; sq2 < 64; sq2++) {
-            int r = std::abs((sq1 >> 3) - (sq2 >> 3));
-            int f = std::abs((sq1 & 7) - (sq2 & 7));
-            manhattanDistance[sq1][sq2] = r + f;
-            kingDistance[sq1][sq2] = std::min(5, std::max(r, f));
-        }
-    }
-}
-
 static int scaleMaterial = DEFAULT_EVAL_SCALE;
 static int scaleKingSafety = DEFAULT_EVAL_SCALE;
 
@@ -199,45 +194,52 @@ void setKingSafetyScale(int s) {
  */
 template <bool debug>
 int Eval::evaluate(Board &b) {
-    int material[2][2] = {{0, 0}, {0, 0}};
-    int egFactorMaterial = 0;
-    // Copy necessary values from Board and precompute the number of each piece on the board as well as material totals
+    // Copy necessary values from Board
     for (int color = WHITE; color <= BLACK; color++) {
-        for (int pieceID = PAWNS; pieceID <= KINGS; pieceID++) {
+        for (int pieceID = PAWNS; pieceID <= KINGS; pieceID++)
             pieces[color][pieceID] = b.getPieces(color, pieceID);
-            pieceCounts[color][pieceID] = count(pieces[color][pieceID]);
-            if (pieceID != KINGS) {
-                material[MG][color] += PIECE_VALUES[MG][pieceID] * pieceCounts[color][pieceID];
-                material[EG][color] += PIECE_VALUES[EG][pieceID] * pieceCounts[color][pieceID];
-                egFactorMaterial += EG_FACTOR_PIECE_VALS[pieceID] * pieceCounts[color][pieceID];
-            }
-        }
     }
     allPieces[WHITE] = b.getAllPieces(WHITE);
     allPieces[BLACK] = b.getAllPieces(BLACK);
     playerToMove = b.getPlayerToMove();
     int kingSq[2] = {b.getKingSq(WHITE), b.getKingSq(BLACK)};
 
-    // Compute endgame factor which is between 0 and EG_FACTOR_RES, inclusive
-    int egFactor = EG_FACTOR_RES - (egFactorMaterial - EG_FACTOR_ALPHA) * EG_FACTOR_RES / EG_FACTOR_BETA;
-    egFactor = std::max(0, std::min(EG_FACTOR_RES, egFactor));
+    // Look up piece counts, material totals, and the endgame factor in the
+    // material hash table, computing them on a miss
+    MaterialHashEntry localMaterialEntry;
+    uint64_t materialKey = b.getMaterialZobristKey();
+    MaterialHashEntry *me = (hashTables != nullptr) ? hashTables->getMaterialEntry(materialKey) : &localMaterialEntry;
+    if (hashTables == nullptr || me->materialKey != materialKey)
+        evaluateMaterial(b, *me);
+
+    pieceCounts = me->pieceCounts;
+    int material[2][2] = {{me->material[MG][WHITE], me->material[MG][BLACK]},
+                          {me->material[EG][WHITE], me->material[EG][BLACK]}};
+    // Endgame factor is between 0 and EG_FACTOR_RES, inclusive
+    int egFactor = me->egFactor;
 
     // Check for special endgames
-    if (egFactor == EG_FACTOR_RES) {
-        int endgameScore = checkEndgameCases();
-        if (endgameScore != -INFTY)
-            return endgameScore;
-    }
+    if (me->endgameEvaluator != nullptr)
+        return (this->*(me->endgameEvaluator))();
+
+    // Look up the pawn structure in the pawn hash table, computing it on a miss
+    PawnHashEntry localPawnEntry;
+    uint64_t pawnKey = b.getPawnZobristKey();
+    PawnHashEntry *pe = (hashTables != nullptr) ? hashTables->getPawnEntry(pawnKey) : &localPawnEntry;
+    if (hashTables == nullptr || pe->pawnKey != pawnKey)
+        evaluatePawns(b, *pe);
 
     // Precompute eval info, such as attack maps
-    PieceMoveList pmlWhite = b.getPieceMoveList(WHITE);
-    PieceMoveList pmlBlack = b.getPieceMoveList(BLACK);
+    PieceMoveList pieceMoveLists[2];
+    b.getPieceMoveLists(pieceMoveLists);
+    PieceMoveList &pmlWhite = pieceMoveLists[WHITE];
+    PieceMoveList &pmlBlack = pieceMoveLists[BLACK];
 
     ei.clear();
 
     // Get the overall attack maps
-    ei.attackMaps[WHITE][PAWNS] = b.getWPawnCaptures(pieces[WHITE][PAWNS]);
-    ei.attackMaps[BLACK][PAWNS] = b.getBPawnCaptures(pieces[BLACK][PAWNS]);
+    ei.attackMaps[WHITE][PAWNS] = pe->attacks[WHITE];
+    ei.attackMaps[BLACK][PAWNS] = pe->attacks[BLACK];
     for (unsigned int i = 0; i < pmlWhite.size(); i++) {
         uint64_t legal = pmlWhite.get(i).legal;
         ei.doubleAttackMaps[WHITE] |= legal & (ei.fullAttackMaps[WHITE] | ei.attackMaps[WHITE][PAWNS]);
@@ -251,17 +253,9 @@ int Eval::evaluate(Board &b) {
         ei.fullAttackMaps[BLACK] |= legal;
     }
 
-    ei.rammedPawns[WHITE] = pieces[WHITE][PAWNS] & (pieces[BLACK][PAWNS] >> 8);
-    ei.rammedPawns[BLACK] = pieces[BLACK][PAWNS] & (pieces[WHITE][PAWNS] << 8);
-
-    uint64_t openFiles = pieces[WHITE][PAWNS] | pieces[BLACK][PAWNS];
-    openFiles |= openFiles >> 8;
-    openFiles |= openFiles >> 16;
-    openFiles |= openFiles >> 32;
-    openFiles |= openFiles << 8;
-    openFiles |= openFiles << 16;
-    openFiles |= openFiles << 32;
-    ei.openFiles = ~openFiles;
+    ei.rammedPawns[WHITE] = pe->rammedPawns[WHITE];
+    ei.rammedPawns[BLACK] = pe->rammedPawns[BLACK];
+    ei.openFiles = pe->openFiles;
 
 
     //---------------------------Material terms---------------------------------
@@ -294,19 +288,7 @@ int Eval::evaluate(Board &b) {
 
 
     // Material imbalance evaluation
-    int imbalanceValue[2] = {0, 0};
-
-    // Own-opp imbalance terms
-    // Gain OWN_OPP_IMBALANCE[][ownID][oppID] centipawns for each ownID piece
-    // you have and each oppID piece the opponent has
-    for (int ownID = KNIGHTS; ownID <= QUEENS; ownID++) {
-        for (int oppID = PAWNS; oppID < ownID; oppID++) {
-            imbalanceValue[MG] += OWN_OPP_IMBALANCE[MG][ownID][oppID] * pieceCounts[WHITE][ownID] * pieceCounts[BLACK][oppID];
-            imbalanceValue[EG] += OWN_OPP_IMBALANCE[EG][ownID][oppID] * pieceCounts[WHITE][ownID] * pieceCounts[BLACK][oppID];
-            imbalanceValue[MG] -= OWN_OPP_IMBALANCE[MG][ownID][oppID] * pieceCounts[BLACK][ownID] * pieceCounts[WHITE][oppID];
-            imbalanceValue[EG] -= OWN_OPP_IMBALANCE[EG][ownID][oppID] * pieceCounts[BLACK][ownID] * pieceCounts[WHITE][oppID];
-        }
-    }
+    const int *imbalanceValue = me->imbalance;
 
     valueMg += imbalanceValue[MG] * scaleMaterial / DEFAULT_EVAL_SCALE;
     valueEg += imbalanceValue[EG] * scaleMaterial / DEFAULT_EVAL_SCALE;
@@ -325,16 +307,8 @@ int Eval::evaluate(Board &b) {
 
 
     //----------------------------Positional terms------------------------------
-    // Pawn piece square tables
-    Score psqtScores[2] = {EVAL_ZERO, EVAL_ZERO};
-    for (int color = WHITE; color <= BLACK; color++) {
-        uint64_t bitboard = pieces[color][PAWNS];
-        while (bitboard) {
-            int sq = bitScanForward(bitboard);
-            bitboard &= bitboard - 1;
-            psqtScores[color] += PSQT[color][PAWNS][sq];
-        }
-    }
+    // Piece square tables, kept up to date by the board
+    Score psqtScores[2] = {b.getPsqtScore(WHITE), b.getPsqtScore(BLACK)};
 
 
     //--------------------------------Space-------------------------------------
@@ -383,10 +357,6 @@ int Eval::evaluate(Board &b) {
     uint64_t kingNeighborhood[2] = {b.getKingSquares(kingSq[WHITE]),
                                     b.getKingSquares(kingSq[BLACK])};
 
-    // Calculate king piece square table scores
-    psqtScores[WHITE] += PSQT[WHITE][KINGS][kingSq[WHITE]];
-    psqtScores[BLACK] += PSQT[BLACK][KINGS][kingSq[BLACK]];
-
     int ksValue[2] = {0, 0};
 
     // All king safety terms are midgame only, so don't calculate them in the endgame
@@ -452,17 +422,8 @@ int Eval::evaluate(Board &b) {
     }
 
 
-    // Get all squares attackable by pawns in the future
-    // Used for outposts and backwards pawns
-    uint64_t wPawnFrontSpan = pieces[WHITE][PAWNS] << 8;
-    uint64_t bPawnFrontSpan = pieces[BLACK][PAWNS] >> 8;
-    for (int i = 0; i < 5; i++) {
-        wPawnFrontSpan |= wPawnFrontSpan << 8;
-        bPawnFrontSpan |= bPawnFrontSpan >> 8;
-    }
-    uint64_t pawnStopAtt[2];
-    pawnStopAtt[WHITE] = ((wPawnFrontSpan >> 1) & NOTH) | ((wPawnFrontSpan << 1) & NOTA);
-    pawnStopAtt[BLACK] = ((bPawnFrontSpan >> 1) & NOTH) | ((bPawnFrontSpan << 1) & NOTA);
+    // All squares attackable by pawns in the future, used for outposts
+    const uint64_t *pawnStopAtt = pe->pawnStopAtt;
 
 
     //-------------------------Minor Pieces and Mobility------------------------
@@ -522,7 +483,6 @@ int Eval::evaluate(Board &b) {
             uint64_t bit = indexToBit(knightSq);
             uint64_t mobilityMap = pml.get(i).legal & mobilitySafeSqs;
 
-            psqtScores[color] += PSQT[color][KNIGHTS][knightSq];
             mobilityScore[color] += MOBILITY[KNIGHTS-1][count(mobilityMap)]
                                  + EXTENDED_CENTER_VAL * count(mobilityMap & EXTENDED_CENTER_SQS)
                                  + CENTER_BONUS * count(mobilityMap & CENTER_SQS);
@@ -547,7 +507,6 @@ int Eval::evaluate(Board &b) {
             uint64_t bit = indexToBit(bishopSq);
             uint64_t mobilityMap = pml.get(i).legal & mobilitySafeSqs;
 
-            psqtScores[color] += PSQT[color][BISHOPS][bishopSq];
             mobilityScore[color] += MOBILITY[BISHOPS-1][count(mobilityMap)]
                                  + EXTENDED_CENTER_VAL * count(mobilityMap & EXTENDED_CENTER_SQS)
                                  + CENTER_BONUS * count(mobilityMap & CENTER_SQS);
@@ -577,7 +536,6 @@ int Eval::evaluate(Board &b) {
             int rank = rookSq >> 3;
             uint64_t mobilityMap = pml.get(i).legal & mobilitySafeSqs;
 
-            psqtScores[color] += PSQT[color][ROOKS][rookSq];
             mobilityScore[color] += MOBILITY[ROOKS-1][count(mobilityMap)]
                                  + EXTENDED_CENTER_VAL * count(mobilityMap & EXTENDED_CENTER_SQS)
                                  + CENTER_BONUS * count(mobilityMap & CENTER_SQS);
@@ -599,7 +557,6 @@ int Eval::evaluate(Board &b) {
             int queenSq = pml.get(i).startSq;
             uint64_t mobilityMap = pml.get(i).legal & mobilitySafeSqs & queenMobilitySafeSqs;
 
-            psqtScores[color] += PSQT[color][QUEENS][queenSq];
             mobilityScore[color] += MOBILITY[QUEENS-1][count(mobilityMap)];
 
             // Penalty if an enemy knight can safely threaten our queen on the next move
@@ -681,36 +638,19 @@ int Eval::evaluate(Board &b) {
 
 
     //----------------------------Pawn structure--------------------------------
-    Score whitePawnScore = EVAL_ZERO, blackPawnScore = EVAL_ZERO;
+    // Terms that depend only on the pawns come from the pawn hash entry
+    Score whitePawnScore = pe->score[WHITE], blackPawnScore = pe->score[BLACK];
+    if (pieces[BLACK][QUEENS] | pieces[BLACK][ROOKS])
+        whitePawnScore += pe->semiopenScore[WHITE];
+    if (pieces[WHITE][QUEENS] | pieces[WHITE][ROOKS])
+        blackPawnScore += pe->semiopenScore[BLACK];
 
     // Passed pawns
-    uint64_t wPassedBlocker = pieces[BLACK][PAWNS] >> 8;
-    uint64_t bPassedBlocker = pieces[WHITE][PAWNS] << 8;
-    // If opposing pawns are on the same or an adjacent file on a pawn's front
-    // span, then the pawn is not passed
-    wPassedBlocker |= ((wPassedBlocker >> 1) & NOTH) | ((wPassedBlocker << 1) & NOTA);
-    bPassedBlocker |= ((bPassedBlocker >> 1) & NOTH) | ((bPassedBlocker << 1) & NOTA);
-    // Include own pawns as blockers to prevent doubled pawns from both being
-    // scored as passers
-    wPassedBlocker |= (pieces[WHITE][PAWNS] >> 8);
-    bPassedBlocker |= (pieces[BLACK][PAWNS] << 8);
-    // Find opposing pawn front spans
-    for(int i = 0; i < 4; i++) {
-        wPassedBlocker |= (wPassedBlocker >> 8);
-        bPassedBlocker |= (bPassedBlocker << 8);
-    }
-    // Passers are pawns outside the opposing pawn front span
-    uint64_t wPassedPawns = pieces[WHITE][PAWNS] & ~wPassedBlocker;
-    uint64_t bPassedPawns = pieces[BLACK][PAWNS] & ~bPassedBlocker;
-
-    uint64_t wPasserTemp = wPassedPawns;
+    uint64_t wPasserTemp = pe->passedPawns[WHITE];
     while (wPasserTemp) {
         int passerSq = bitScanForward(wPasserTemp);
         wPasserTemp &= wPasserTemp - 1;
-        int file = passerSq & 7;
         int rank = passerSq >> 3;
-        whitePawnScore += PASSER_BONUS[rank];
-        whitePawnScore += PASSER_FILE_BONUS[file];
 
         // Non-linear bonus based on rank
         int rFactor = (rank-1) * (rank-2) / 2;
@@ -753,14 +693,11 @@ int Eval::evaluate(Board &b) {
             whitePawnScore += OPP_KING_DIST * (int) kingDistance[passerSq+8][kingSq[BLACK]] * rFactor;
         }
     }
-    uint64_t bPasserTemp = bPassedPawns;
+    uint64_t bPasserTemp = pe->passedPawns[BLACK];
     while (bPasserTemp) {
         int passerSq = bitScanForward(bPasserTemp);
         bPasserTemp &= bPasserTemp - 1;
-        int file = passerSq & 7;
         int rank = 7 - (passerSq >> 3);
-        blackPawnScore += PASSER_BONUS[rank];
-        blackPawnScore += PASSER_FILE_BONUS[file];
 
         int rFactor = (rank-1) * (rank-2) / 2;
         if (rFactor) {
@@ -796,144 +733,6 @@ int Eval::evaluate(Board &b) {
         }
     }
 
-    // Doubled pawns
-    whitePawnScore += DOUBLED_PENALTY * count(pieces[WHITE][PAWNS] & (pieces[WHITE][PAWNS] << 8));
-    blackPawnScore += DOUBLED_PENALTY * count(pieces[BLACK][PAWNS] & (pieces[BLACK][PAWNS] >> 8));
-
-    // Isolated pawns
-    // Count the pawns on each file
-    int wPawnCtByFile[8];
-    int bPawnCtByFile[8];
-    for (int i = 0; i < 8; i++) {
-        wPawnCtByFile[i] = count(pieces[WHITE][PAWNS] & FILES[i]);
-        bPawnCtByFile[i] = count(pieces[BLACK][PAWNS] & FILES[i]);
-    }
-    // Fill a bitmap of which files have pawns
-    uint64_t wIsolated = 0, bIsolated = 0;
-    for (int i = 7; i >= 0; i--) {
-        wIsolated |= (bool) (wPawnCtByFile[i]);
-        bIsolated |= (bool) (bPawnCtByFile[i]);
-        wIsolated <<= 1;
-        bIsolated <<= 1;
-    }
-    wIsolated >>= 1;
-    bIsolated >>= 1;
-    // If there are pawns on either adjacent file, we remove this pawn
-    wIsolated &= ~((wIsolated >> 1) | (wIsolated << 1));
-    bIsolated &= ~((bIsolated >> 1) | (bIsolated << 1));
-
-    uint64_t wIsolatedBB = wIsolated;
-    wIsolatedBB |= wIsolatedBB << 8;
-    wIsolatedBB |= wIsolatedBB << 16;
-    wIsolatedBB |= wIsolatedBB << 32;
-    uint64_t bIsolatedBB = bIsolated;
-    bIsolatedBB |= bIsolatedBB << 8;
-    bIsolatedBB |= bIsolatedBB << 16;
-    bIsolatedBB |= bIsolatedBB << 32;
-
-    // Score isolated pawns
-    for (int f = 0; f < 8; f++) {
-        if (wIsolated & indexToBit(f)) {
-            whitePawnScore += ISOLATED_PENALTY * wPawnCtByFile[f];
-            if (!(FILES[f] & pieces[BLACK][PAWNS]) && (pieces[BLACK][QUEENS] | pieces[BLACK][ROOKS]))
-                whitePawnScore += ISOLATED_SEMIOPEN_PENALTY * wPawnCtByFile[f];
-        }
-        if (bIsolated & indexToBit(f)) {
-            blackPawnScore += ISOLATED_PENALTY * bPawnCtByFile[f];
-            if (!(FILES[f] & pieces[WHITE][PAWNS]) && (pieces[WHITE][QUEENS] | pieces[WHITE][ROOKS]))
-                blackPawnScore += ISOLATED_SEMIOPEN_PENALTY * bPawnCtByFile[f];
-        }
-    }
-
-    // Backward pawns
-    uint64_t wBadStopSqs = ~pawnStopAtt[WHITE] & ei.attackMaps[BLACK][PAWNS];
-    uint64_t bBadStopSqs = ~pawnStopAtt[BLACK] & ei.attackMaps[WHITE][PAWNS];
-    for (int i = 0; i < 6; i++) {
-        wBadStopSqs |= wBadStopSqs >> 8;
-        bBadStopSqs |= bBadStopSqs << 8;
-    }
-
-    uint64_t wBackwards = wBadStopSqs & pieces[WHITE][PAWNS] & ~wIsolatedBB & ~ei.attackMaps[BLACK][PAWNS];
-    uint64_t bBackwards = bBadStopSqs & pieces[BLACK][PAWNS] & ~bIsolatedBB & ~ei.attackMaps[WHITE][PAWNS];
-    whitePawnScore += BACKWARD_PENALTY * count(wBackwards);
-    blackPawnScore += BACKWARD_PENALTY * count(bBackwards);
-
-    // Semi-open files with backwards pawns
-    uint64_t wBackwardsTemp = wBackwards;
-    while (wBackwardsTemp) {
-        int pawnSq = bitScanForward(wBackwardsTemp);
-        wBackwardsTemp &= wBackwardsTemp - 1;
-        int f = pawnSq & 7;
-        if (!(FILES[f] & pieces[BLACK][PAWNS]) && (pieces[BLACK][QUEENS] | pieces[BLACK][ROOKS])) {
-            whitePawnScore += BACKWARD_SEMIOPEN_PENALTY;
-        }
-    }
-    uint64_t bBackwardsTemp = bBackwards;
-    while (bBackwardsTemp) {
-        int pawnSq = bitScanForward(bBackwardsTemp);
-        bBackwardsTemp &= bBackwardsTemp - 1;
-        int f = pawnSq & 7;
-        if (!(FILES[f] & pieces[WHITE][PAWNS]) && (pieces[WHITE][QUEENS] | pieces[WHITE][ROOKS])) {
-            blackPawnScore += BACKWARD_SEMIOPEN_PENALTY;
-        }
-    }
-
-    // Undefended pawns
-    uint64_t wUndefendedPawns = pieces[WHITE][PAWNS] & ~ei.attackMaps[WHITE][PAWNS] & ~wBackwards & ~wIsolatedBB;
-    uint64_t bUndefendedPawns = pieces[BLACK][PAWNS] & ~ei.attackMaps[BLACK][PAWNS] & ~bBackwards & ~bIsolatedBB;
-    whitePawnScore += UNDEFENDED_PAWN_PENALTY * count(wUndefendedPawns);
-    blackPawnScore += UNDEFENDED_PAWN_PENALTY * count(bUndefendedPawns);
-
-    // Pawn phalanxes
-    uint64_t wPawnPhalanx = (pieces[WHITE][PAWNS] & (pieces[WHITE][PAWNS] << 1) & NOTA)
-                          | (pieces[WHITE][PAWNS] & (pieces[WHITE][PAWNS] >> 1) & NOTH);
-    uint64_t bPawnPhalanx = (pieces[BLACK][PAWNS] & (pieces[BLACK][PAWNS] << 1) & NOTA)
-                          | (pieces[BLACK][PAWNS] & (pieces[BLACK][PAWNS] >> 1) & NOTH);
-    while (wPawnPhalanx) {
-        int pawnSq = bitScanForward(wPawnPhalanx);
-        wPawnPhalanx &= wPawnPhalanx - 1;
-        int r = pawnSq >> 3;
-        int bonus = PAWN_PHALANX_BONUS[r];
-        whitePawnScore += bonus;
-        int f = pawnSq & 7;
-        if (!(FILES[f] & pieces[BLACK][PAWNS]))
-            whitePawnScore += bonus;
-    }
-    while (bPawnPhalanx) {
-        int pawnSq = bitScanForward(bPawnPhalanx);
-        bPawnPhalanx &= bPawnPhalanx - 1;
-        int r = 7 - (pawnSq >> 3);
-        int bonus = PAWN_PHALANX_BONUS[r];
-        blackPawnScore += bonus;
-        int f = pawnSq & 7;
-        if (!(FILES[f] & pieces[WHITE][PAWNS]))
-            blackPawnScore += bonus;
-    }
-
-    // Other connected pawns
-    uint64_t wConnected = pieces[WHITE][PAWNS] & ei.attackMaps[WHITE][PAWNS];
-    uint64_t bConnected = pieces[BLACK][PAWNS] & ei.attackMaps[BLACK][PAWNS];
-    while (wConnected) {
-        int pawnSq = bitScanForward(wConnected);
-        wConnected &= wConnected - 1;
-        int r = pawnSq >> 3;
-        int bonus = PAWN_CONNECTED_BONUS[r];
-        whitePawnScore += bonus;
-        int f = pawnSq & 7;
-        if (!(FILES[f] & pieces[BLACK][PAWNS]))
-            whitePawnScore += bonus;
-    }
-    while (bConnected) {
-        int pawnSq = bitScanForward(bConnected);
-        bConnected &= bConnected - 1;
-        int r = 7 - (pawnSq >> 3);
-        int bonus = PAWN_CONNECTED_BONUS[r];
-        blackPawnScore += bonus;
-        int f = pawnSq & 7;
-        if (!(FILES[f] & pieces[WHITE][PAWNS]))
-            blackPawnScore += bonus;
-    }
-    
     valueMg += decEvalMg(whitePawnScore) - decEvalMg(blackPawnScore);
     valueEg += decEvalEg(whitePawnScore) - decEvalEg(blackPawnScore);
 
@@ -968,18 +767,8 @@ int Eval::evaluate(Board &b) {
 
     // Adjust endgame eval based on the probability of converting the advantage to a win
     if (egFactor > 0) {
-        uint64_t wPawnAsymmetry = pieces[WHITE][PAWNS];
-        wPawnAsymmetry |= wPawnAsymmetry >> 8;
-        wPawnAsymmetry |= wPawnAsymmetry >> 16;
-        wPawnAsymmetry |= wPawnAsymmetry >> 32;
-        wPawnAsymmetry &= 0xFF;
-        uint64_t bPawnAsymmetry = pieces[BLACK][PAWNS];
-        bPawnAsymmetry |= bPawnAsymmetry >> 8;
-        bPawnAsymmetry |= bPawnAsymmetry >> 16;
-        bPawnAsymmetry |= bPawnAsymmetry >> 32;
-        bPawnAsymmetry &= 0xFF;
         // Asymmetry: greater asymmetry means less locked position, more potential passers
-        int pawnAsymmetry = count((wPawnAsymmetry & ~bPawnAsymmetry) | (~wPawnAsymmetry & bPawnAsymmetry));
+        int pawnAsymmetry = pe->pawnAsymmetry;
         // King opposition distance: when kings are farther apart by file, there is a
         // lower chance of the defending king keeping the attacking king from penetrating
         int oppositionDistance = std::abs((kingSq[WHITE] & 7)  - (kingSq[BLACK] & 7))
@@ -1054,6 +843,270 @@ int Eval::evaluate(Board &b) {
 template int Eval::evaluate<true>(Board &b);
 template int Eval::evaluate<false>(Board &b);
 
+// Computes the piece counts and the evaluation terms that depend only on them,
+// storing them in a material hash entry so that later evaluations with the
+// same material can reuse them.
+void Eval::evaluateMaterial(Board &b, MaterialHashEntry &me) {
+    me.materialKey = b.getMaterialZobristKey();
+    int egFactorMaterial = 0;
+    for (int color = WHITE; color <= BLACK; color++) {
+        me.material[MG][color] = 0;
+        me.material[EG][color] = 0;
+        for (int pieceID = PAWNS; pieceID <= KINGS; pieceID++) {
+            me.pieceCounts[color][pieceID] = count(pieces[color][pieceID]);
+            if (pieceID != KINGS) {
+                me.material[MG][color] += PIECE_VALUES[MG][pieceID] * me.pieceCounts[color][pieceID];
+                me.material[EG][color] += PIECE_VALUES[EG][pieceID] * me.pieceCounts[color][pieceID];
+                egFactorMaterial += EG_FACTOR_PIECE_VALS[pieceID] * me.pieceCounts[color][pieceID];
+            }
+        }
+    }
+
+    // Compute endgame factor which is between 0 and EG_FACTOR_RES, inclusive
+    me.egFactor = EG_FACTOR_RES - (egFactorMaterial - EG_FACTOR_ALPHA) * EG_FACTOR_RES / EG_FACTOR_BETA;
+    me.egFactor = std::max(0, std::min(EG_FACTOR_RES, me.egFactor));
+
+    // Own-opp imbalance terms
+    // Gain OWN_OPP_IMBALANCE[][ownID][oppID] centipawns for each ownID piece
+    // you have and each oppID piece the opponent has
+    me.imbalance[MG] = 0;
+    me.imbalance[EG] = 0;
+    for (int ownID = KNIGHTS; ownID <= QUEENS; ownID++) {
+        for (int oppID = PAWNS; oppID < ownID; oppID++) {
+            me.imbalance[MG] += OWN_OPP_IMBALANCE[MG][ownID][oppID] * me.pieceCounts[WHITE][ownID] * me.pieceCounts[BLACK][oppID];
+            me.imbalance[EG] += OWN_OPP_IMBALANCE[EG][ownID][oppID] * me.pieceCounts[WHITE][ownID] * me.pieceCounts[BLACK][oppID];
+            me.imbalance[MG] -= OWN_OPP_IMBALANCE[MG][ownID][oppID] * me.pieceCounts[BLACK][ownID] * me.pieceCounts[WHITE][oppID];
+            me.imbalance[EG] -= OWN_OPP_IMBALANCE[EG][ownID][oppID] * me.pieceCounts[BLACK][ownID] * me.pieceCounts[WHITE][oppID];
+        }
+    }
+
+    // Special endgames are only checked with no non-pawn material beyond what
+    // is needed for a fully endgame position
+    me.endgameEvaluator = (me.egFactor == EG_FACTOR_RES) ? getEndgameEvaluator(me.pieceCounts) : nullptr;
+}
+
+// Computes the evaluation terms and bitboards that depend only on the pawns,
+// storing them in a pawn hash entry so that later evaluations with the same
+// pawn structure can reuse them.
+void Eval::evaluatePawns(Board &b, PawnHashEntry &pe) {
+    pe.pawnKey = b.getPawnZobristKey();
+    pe.attacks[WHITE] = b.getWPawnCaptures(pieces[WHITE][PAWNS]);
+    pe.attacks[BLACK] = b.getBPawnCaptures(pieces[BLACK][PAWNS]);
+
+    pe.rammedPawns[WHITE] = pieces[WHITE][PAWNS] & (pieces[BLACK][PAWNS] >> 8);
+    pe.rammedPawns[BLACK] = pieces[BLACK][PAWNS] & (pieces[WHITE][PAWNS] << 8);
+
+    uint64_t openFiles = pieces[WHITE][PAWNS] | pieces[BLACK][PAWNS];
+    openFiles |= openFiles >> 8;
+    openFiles |= openFiles >> 16;
+    openFiles |= openFiles >> 32;
+    openFiles |= openFiles << 8;
+    openFiles |= openFiles << 16;
+    openFiles |= openFiles << 32;
+    pe.openFiles = ~openFiles;
+
+    // Get all squares attackable by pawns in the future
+    // Used for outposts and backwards pawns
+    uint64_t wPawnFrontSpan = pieces[WHITE][PAWNS] << 8;
+    uint64_t bPawnFrontSpan = pieces[BLACK][PAWNS] >> 8;
+    for (int i = 0; i < 5; i++) {
+        wPawnFrontSpan |= wPawnFrontSpan << 8;
+        bPawnFrontSpan |= bPawnFrontSpan >> 8;
+    }
+    uint64_t *pawnStopAtt = pe.pawnStopAtt;
+    pawnStopAtt[WHITE] = ((wPawnFrontSpan >> 1) & NOTH) | ((wPawnFrontSpan << 1) & NOTA);
+    pawnStopAtt[BLACK] = ((bPawnFrontSpan >> 1) & NOTH) | ((bPawnFrontSpan << 1) & NOTA);
+
+    pe.score[WHITE] = pe.score[BLACK] = EVAL_ZERO;
+    pe.semiopenScore[WHITE] = pe.semiopenScore[BLACK] = 0;
+
+    // Passed pawns
+    uint64_t wPassedBlocker = pieces[BLACK][PAWNS] >> 8;
+    uint64_t bPassedBlocker = pieces[WHITE][PAWNS] << 8;
+    // If opposing pawns are on the same or an adjacent file on a pawn's front
+    // span, then the pawn is not passed
+    wPassedBlocker |= ((wPassedBlocker >> 1) & NOTH) | ((wPassedBlocker << 1) & NOTA);
+    bPassedBlocker |= ((bPassedBlocker >> 1) & NOTH) | ((bPassedBlocker << 1) & NOTA);
+    // Include own pawns as blockers to prevent doubled pawns from both being
+    // scored as passers
+    wPassedBlocker |= (pieces[WHITE][PAWNS] >> 8);
+    bPassedBlocker |= (pieces[BLACK][PAWNS] << 8);
+    // Find opposing pawn front spans
+    for(int i = 0; i < 4; i++) {
+        wPassedBlocker |= (wPassedBlocker >> 8);
+        bPassedBlocker |= (bPassedBlocker << 8);
+    }
+    // Passers are pawns outside the opposing pawn front span
+    uint64_t wPassedPawns = pieces[WHITE][PAWNS] & ~wPassedBlocker;
+    uint64_t bPassedPawns = pieces[BLACK][PAWNS] & ~bPassedBlocker;
+    pe.passedPawns[WHITE] = wPassedPawns;
+    pe.passedPawns[BLACK] = bPassedPawns;
+
+    // Rank and file bonuses for passers. Bonuses depending on other pieces are
+    // calculated in evaluate().
+    while (wPassedPawns) {
+        int passerSq = bitScanForward(wPassedPawns);
+        wPassedPawns &= wPassedPawns - 1;
+        pe.score[WHITE] += PASSER_BONUS[passerSq >> 3];
+        pe.score[WHITE] += PASSER_FILE_BONUS[passerSq & 7];
+    }
+    while (bPassedPawns) {
+        int passerSq = bitScanForward(bPassedPawns);
+        bPassedPawns &= bPassedPawns - 1;
+        pe.score[BLACK] += PASSER_BONUS[7 - (passerSq >> 3)];
+        pe.score[BLACK] += PASSER_FILE_BONUS[passerSq & 7];
+    }
+
+    // Doubled pawns
+    pe.score[WHITE] += DOUBLED_PENALTY * count(pieces[WHITE][PAWNS] & (pieces[WHITE][PAWNS] << 8));
+    pe.score[BLACK] += DOUBLED_PENALTY * count(pieces[BLACK][PAWNS] & (pieces[BLACK][PAWNS] >> 8));
+
+    // Isolated pawns
+    // Count the pawns on each file
+    int wPawnCtByFile[8];
+    int bPawnCtByFile[8];
+    for (int i = 0; i < 8; i++) {
+        wPawnCtByFile[i] = count(pieces[WHITE][PAWNS] & FILES[i]);
+        bPawnCtByFile[i] = count(pieces[BLACK][PAWNS] & FILES[i]);
+    }
+    // Fill a bitmap of which files have pawns
+    uint64_t wIsolated = 0, bIsolated = 0;
+    for (int i = 7; i >= 0; i--) {
+        wIsolated |= (bool) (wPawnCtByFile[i]);
+        bIsolated |= (bool) (bPawnCtByFile[i]);
+        wIsolated <<= 1;
+        bIsolated <<= 1;
+    }
+    wIsolated >>= 1;
+    bIsolated >>= 1;
+    // If there are pawns on either adjacent file, we remove this pawn
+    wIsolated &= ~((wIsolated >> 1) | (wIsolated << 1));
+    bIsolated &= ~((bIsolated >> 1) | (bIsolated << 1));
+
+    uint64_t wIsolatedBB = wIsolated;
+    wIsolatedBB |= wIsolatedBB << 8;
+    wIsolatedBB |= wIsolatedBB << 16;
+    wIsolatedBB |= wIsolatedBB << 32;
+    uint64_t bIsolatedBB = bIsolated;
+    bIsolatedBB |= bIsolatedBB << 8;
+    bIsolatedBB |= bIsolatedBB << 16;
+    bIsolatedBB |= bIsolatedBB << 32;
+
+    // Score isolated pawns
+    for (int f = 0; f < 8; f++) {
+        if (wIsolated & indexToBit(f)) {
+            pe.score[WHITE] += ISOLATED_PENALTY * wPawnCtByFile[f];
+            if (!(FILES[f] & pieces[BLACK][PAWNS]))
+                pe.semiopenScore[WHITE] += ISOLATED_SEMIOPEN_PENALTY * wPawnCtByFile[f];
+        }
+        if (bIsolated & indexToBit(f)) {
+            pe.score[BLACK] += ISOLATED_PENALTY * bPawnCtByFile[f];
+            if (!(FILES[f] & pieces[WHITE][PAWNS]))
+                pe.semiopenScore[BLACK] += ISOLATED_SEMIOPEN_PENALTY * bPawnCtByFile[f];
+        }
+    }
+
+    // Backward pawns
+    uint64_t wBadStopSqs = ~pawnStopAtt[WHITE] & pe.attacks[BLACK];
+    uint64_t bBadStopSqs = ~pawnStopAtt[BLACK] & pe.attacks[WHITE];
+    for (int i = 0; i < 6; i++) {
+        wBadStopSqs |= wBadStopSqs >> 8;
+        bBadStopSqs |= bBadStopSqs << 8;
+    }
+
+    uint64_t wBackwards = wBadStopSqs & pieces[WHITE][PAWNS] & ~wIsolatedBB & ~pe.attacks[BLACK];
+    uint64_t bBackwards = bBadStopSqs & pieces[BLACK][PAWNS] & ~bIsolatedBB & ~pe.attacks[WHITE];
+    pe.score[WHITE] += BACKWARD_PENALTY * count(wBackwards);
+    pe.score[BLACK] += BACKWARD_PENALTY * count(bBackwards);
+
+    // Semi-open files with backwards pawns
+    uint64_t wBackwardsTemp = wBackwards;
+    while (wBackwardsTemp) {
+        int pawnSq = bitScanForward(wBackwardsTemp);
+        wBackwardsTemp &= wBackwardsTemp - 1;
+        int f = pawnSq & 7;
+        if (!(FILES[f] & pieces[BLACK][PAWNS]))
+            pe.semiopenScore[WHITE] += BACKWARD_SEMIOPEN_PENALTY;
+    }
+    uint64_t bBackwardsTemp = bBackwards;
+    while (bBackwardsTemp) {
+        int pawnSq = bitScanForward(bBackwardsTemp);
+        bBackwardsTemp &= bBackwardsTemp - 1;
+        int f = pawnSq & 7;
+        if (!(FILES[f] & pieces[WHITE][PAWNS]))
+            pe.semiopenScore[BLACK] += BACKWARD_SEMIOPEN_PENALTY;
+    }
+
+    // Undefended pawns
+    uint64_t wUndefendedPawns = pieces[WHITE][PAWNS] & ~pe.attacks[WHITE] & ~wBackwards & ~wIsolatedBB;
+    uint64_t bUndefendedPawns = pieces[BLACK][PAWNS] & ~pe.attacks[BLACK] & ~bBackwards & ~bIsolatedBB;
+    pe.score[WHITE] += UNDEFENDED_PAWN_PENALTY * count(wUndefendedPawns);
+    pe.score[BLACK] += UNDEFENDED_PAWN_PENALTY * count(bUndefendedPawns);
+
+    // Pawn phalanxes
+    uint64_t wPawnPhalanx = (pieces[WHITE][PAWNS] & (pieces[WHITE][PAWNS] << 1) & NOTA)
+                          | (pieces[WHITE][PAWNS] & (pieces[WHITE][PAWNS] >> 1) & NOTH);
+    uint64_t bPawnPhalanx = (pieces[BLACK][PAWNS] & (pieces[BLACK][PAWNS] << 1) & NOTA)
+                          | (pieces[BLACK][PAWNS] & (pieces[BLACK][PAWNS] >> 1) & NOTH);
+    while (wPawnPhalanx) {
+        int pawnSq = bitScanForward(wPawnPhalanx);
+        wPawnPhalanx &= wPawnPhalanx - 1;
+        int r = pawnSq >> 3;
+        int bonus = PAWN_PHALANX_BONUS[r];
+        pe.score[WHITE] += bonus;
+        int f = pawnSq & 7;
+        if (!(FILES[f] & pieces[BLACK][PAWNS]))
+            pe.score[WHITE] += bonus;
+    }
+    while (bPawnPhalanx) {
+        int pawnSq = bitScanForward(bPawnPhalanx);
+        bPawnPhalanx &= bPawnPhalanx - 1;
+        int r = 7 - (pawnSq >> 3);
+        int bonus = PAWN_PHALANX_BONUS[r];
+        pe.score[BLACK] += bonus;
+        int f = pawnSq & 7;
+        if (!(FILES[f] & pieces[WHITE][PAWNS]))
+            pe.score[BLACK] += bonus;
+    }
+
+    // Other connected pawns
+    uint64_t wConnected = pieces[WHITE][PAWNS] & pe.attacks[WHITE];
+    uint64_t bConnected = pieces[BLACK][PAWNS] & pe.attacks[BLACK];
+    while (wConnected) {
+        int pawnSq = bitScanForward(wConnected);
+        wConnected &= wConnected - 1;
+        int r = pawnSq >> 3;
+        int bonus = PAWN_CONNECTED_BONUS[r];
+        pe.score[WHITE] += bonus;
+        int f = pawnSq & 7;
+        if (!(FILES[f] & pieces[BLACK][PAWNS]))
+            pe.score[WHITE] += bonus;
+    }
+    while (bConnected) {
+        int pawnSq = bitScanForward(bConnected);
+        bConnected &= bConnected - 1;
+        int r = 7 - (pawnSq >> 3);
+        int bonus = PAWN_CONNECTED_BONUS[r];
+        pe.score[BLACK] += bonus;
+        int f = pawnSq & 7;
+        if (!(FILES[f] & pieces[WHITE][PAWNS]))
+            pe.score[BLACK] += bonus;
+    }
+
+    // Asymmetry: greater asymmetry means less locked position, more potential passers
+    uint64_t wPawnAsymmetry = pieces[WHITE][PAWNS];
+    wPawnAsymmetry |= wPawnAsymmetry >> 8;
+    wPawnAsymmetry |= wPawnAsymmetry >> 16;
+    wPawnAsymmetry |= wPawnAsymmetry >> 32;
+    wPawnAsymmetry &= 0xFF;
+    uint64_t bPawnAsymmetry = pieces[BLACK][PAWNS];
+    bPawnAsymmetry |= bPawnAsymmetry >> 8;
+    bPawnAsymmetry |= bPawnAsymmetry >> 16;
+    bPawnAsymmetry |= bPawnAsymmetry >> 32;
+    bPawnAsymmetry &= 0xFF;
+    pe.pawnAsymmetry = count((wPawnAsymmetry & ~bPawnAsymmetry) | (~wPawnAsymmetry & bPawnAsymmetry));
+}
+
 // King safety, based on the number of opponent pieces near the king
 // The lookup table approach is inspired by Ed Schroder's Rebel chess engine,
 // and by Stockfish
@@ -1180,143 +1233,161 @@ int Eval::getKingSafety(Board &b, PieceMoveList &attackers, uint64_t kingSqs, in
     return std::min(kingSafetyPts * kingSafetyPts / KS_ARRAY_FACTOR, 600) + kingPressure;
 }
 
+int Eval::evaluateDraw() {
+    return 0;
+}
+
+// A simple forced mate: the winning side only needs to drive the opposing
+// king into a corner
+template <int color>
+int Eval::evaluateKXK() {
+    return scoreSimpleKnownWin(color);
+}
+
+// TODO detect when KPvK is drawn
+template <int color>
+int Eval::evaluateKPK() {
+    int pawnSq = bitScanForward(pieces[color][PAWNS]);
+    int r = (color == WHITE) ? (pawnSq >> 3) : 7 - (pawnSq >> 3);
+    int value = 3 * PIECE_VALUES[EG][PAWNS] / 2 + 5 * (r - 1) * (r - 2);
+    return (color == WHITE) ? value : -value;
+}
+
+// Pawn + anything is a win
+// TODO bishop can block losing king's path to queen square
+template <>
+int Eval::evaluateKPXK<WHITE>() {
+    int value = KNOWN_WIN / 2;
+    int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
+    int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
+    int wPawnSq = bitScanForward(pieces[WHITE][PAWNS]);
+    int wf = wPawnSq & 7;
+    int wr = wPawnSq >> 3;
+    if (pieces[WHITE][BISHOPS]
+     && ((wf == 0 && (pieces[WHITE][BISHOPS] & DARK))
+      || (wf == 7 && (pieces[WHITE][BISHOPS] & LIGHT)))) {
+        int wDist = std::max(7 - (wKingSq >> 3), std::abs((wKingSq & 7) - wf));
+        int bDist = std::max(7 - (bKingSq >> 3), std::abs((bKingSq & 7) - wf));
+        int wQueenDist = std::min(7-wr, 5) + 1;
+        if (playerToMove == BLACK)
+            bDist--;
+        if (bDist < std::min(wDist, wQueenDist))
+            return 0;
+    }
+
+    value += 8 * wr * wr;
+    value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
+    return value;
+}
+
+template <>
+int Eval::evaluateKPXK<BLACK>() {
+    int value = -KNOWN_WIN / 2;
+    int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
+    int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
+    int bPawnSq = bitScanForward(pieces[BLACK][PAWNS]);
+    int bf = bPawnSq & 7;
+    int br = bPawnSq >> 3;
+    if (pieces[BLACK][BISHOPS]
+     && ((bf == 0 && (pieces[BLACK][BISHOPS] & LIGHT))
+      || (bf == 7 && (pieces[BLACK][BISHOPS] & DARK)))) {
+        int wDist = std::max((wKingSq >> 3), std::abs((wKingSq & 7) - bf));
+        int bDist = std::max((bKingSq >> 3), std::abs((bKingSq & 7) - bf));
+        int bQueenDist = std::min(br, 5) + 1;
+        if (playerToMove == WHITE)
+            wDist--;
+        if (wDist < std::min(bDist, bQueenDist))
+            return 0;
+    }
+
+    value -= 8 * br * br;
+    value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
+    return value;
+}
+
+// Mating with knight and bishop: the losing king must be driven into a corner
+// of the bishop's color
+template <int color>
+int Eval::evaluateKBNK() {
+    int value = (color == WHITE) ? KNOWN_WIN : -KNOWN_WIN;
+    int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
+    int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
+    int loserKingSq = (color == WHITE) ? bKingSq : wKingSq;
+    value += scoreCornerDistance(color, wKingSq, bKingSq);
+
+    int cornerDist;
+    // Light squared corners are H1 (7) and A8 (56)
+    if (pieces[color][BISHOPS] & LIGHT)
+        cornerDist = 20 * (int)std::min(manhattanDistance[loserKingSq][7], manhattanDistance[loserKingSq][56]);
+    // Dark squared corners are A1 (0) and H8 (63)
+    else
+        cornerDist = 20 * (int)std::min(manhattanDistance[loserKingSq][0], manhattanDistance[loserKingSq][63]);
+    return (color == WHITE) ? value - cornerDist : value + cornerDist;
+}
+
 // Check special endgame cases: where help mate is possible (detecting this
 // is delegated to search), but forced mate is not, or where a simple
-// forced mate is possible.
-int Eval::checkEndgameCases() {
-    int numWPieces = count(allPieces[WHITE]) - 1;
-    int numBPieces = count(allPieces[BLACK]) - 1;
+// forced mate is possible. Returns the evaluator for the material
+// configuration, or nullptr if it is not a special endgame.
+EndgameEvaluator Eval::getEndgameEvaluator(const int counts[2][6]) {
+    int numWPieces = 0, numBPieces = 0;
+    for (int pieceID = PAWNS; pieceID <= QUEENS; pieceID++) {
+        numWPieces += counts[WHITE][pieceID];
+        numBPieces += counts[BLACK][pieceID];
+    }
     int numPieces = numWPieces + numBPieces;
 
     // Rook or queen + anything else vs. lone king is a forced win
-    if (numBPieces == 0 && (pieces[WHITE][ROOKS] || pieces[WHITE][QUEENS])) {
-        return scoreSimpleKnownWin(WHITE);
-    }
-    if (numWPieces == 0 && (pieces[BLACK][ROOKS] || pieces[BLACK][QUEENS])) {
-        return scoreSimpleKnownWin(BLACK);
-    }
+    if (numBPieces == 0 && (counts[WHITE][ROOKS] || counts[WHITE][QUEENS]))
+        return &Eval::evaluateKXK<WHITE>;
+    if (numWPieces == 0 && (counts[BLACK][ROOKS] || counts[BLACK][QUEENS]))
+        return &Eval::evaluateKXK<BLACK>;
 
-    // TODO detect when KPvK is drawn
     if (numPieces == 1) {
-        if (pieces[WHITE][PAWNS]) {
-            int wPawn = bitScanForward(pieces[WHITE][PAWNS]);
-            int r = (wPawn >> 3);
-            return 3 * PIECE_VALUES[EG][PAWNS] / 2 + 5 * (r - 1) * (r - 2);
-        }
-        if (pieces[BLACK][PAWNS]) {
-            int bPawn = bitScanForward(pieces[BLACK][PAWNS]);
-            int r = 7 - (bPawn >> 3);
-            return -3 * PIECE_VALUES[EG][PAWNS] / 2 - 5 * (r - 1) * (r - 2);
-        }
+        if (counts[WHITE][PAWNS])
+            return &Eval::evaluateKPK<WHITE>;
+        if (counts[BLACK][PAWNS])
+            return &Eval::evaluateKPK<BLACK>;
     }
 
     else if (numPieces == 2) {
         // If white has one piece, the other must be black's
         if (numWPieces == 1) {
             // If each side has one minor piece, then draw
-            if ((pieces[WHITE][KNIGHTS] | pieces[WHITE][BISHOPS])
-             && (pieces[BLACK][KNIGHTS] | pieces[BLACK][BISHOPS]))
-                return 0;
+            if ((counts[WHITE][KNIGHTS] || counts[WHITE][BISHOPS])
+             && (counts[BLACK][KNIGHTS] || counts[BLACK][BISHOPS]))
+                return &Eval::evaluateDraw;
             // If each side has a rook, then draw
-            if (pieces[WHITE][ROOKS] && pieces[BLACK][ROOKS])
-                return 0;
+            if (counts[WHITE][ROOKS] && counts[BLACK][ROOKS])
+                return &Eval::evaluateDraw;
             // If each side has a queen, then draw
-            if (pieces[WHITE][QUEENS] && pieces[BLACK][QUEENS])
-                return 0;
+            if (counts[WHITE][QUEENS] && counts[BLACK][QUEENS])
+                return &Eval::evaluateDraw;
         }
         // Otherwise, one side has both pieces
         else {
             // Pawn + anything is a win
-            // TODO bishop can block losing king's path to queen square
-            if (pieces[WHITE][PAWNS]) {
-                int value = KNOWN_WIN / 2;
-                int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
-                int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
-                int wPawnSq = bitScanForward(pieces[WHITE][PAWNS]);
-                int wf = wPawnSq & 7;
-                int wr = wPawnSq >> 3;
-                if (pieces[WHITE][BISHOPS]
-                 && ((wf == 0 && (pieces[WHITE][BISHOPS] & DARK))
-                  || (wf == 7 && (pieces[WHITE][BISHOPS] & LIGHT)))) {
-                    int wDist = std::max(7 - (wKingSq >> 3), std::abs((wKingSq & 7) - wf));
-                    int bDist = std::max(7 - (bKingSq >> 3), std::abs((bKingSq & 7) - wf));
-                    int wQueenDist = std::min(7-wr, 5) + 1;
-                    if (playerToMove == BLACK)
-                        bDist--;
-                    if (bDist < std::min(wDist, wQueenDist))
-                        return 0;
-                }
-
-                value += 8 * wr * wr;
-                value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
-                return value;
-            }
-            if (pieces[BLACK][PAWNS]) {
-                int value = -KNOWN_WIN / 2;
-                int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
-                int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
-                int bPawnSq = bitScanForward(pieces[BLACK][PAWNS]);
-                int bf = bPawnSq & 7;
-                int br = bPawnSq >> 3;
-                if (pieces[BLACK][BISHOPS]
-                 && ((bf == 0 && (pieces[BLACK][BISHOPS] & LIGHT))
-                  || (bf == 7 && (pieces[BLACK][BISHOPS] & DARK)))) {
-                    int wDist = std::max((wKingSq >> 3), std::abs((wKingSq & 7) - bf));
-                    int bDist = std::max((bKingSq >> 3), std::abs((bKingSq & 7) - bf));
-                    int bQueenDist = std::min(br, 5) + 1;
-                    if (playerToMove == WHITE)
-                        wDist--;
-                    if (wDist < std::min(bDist, bQueenDist))
-                        return 0;
-                }
-
-                value -= 8 * br * br;
-                value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
-                return value;
-            }
+            if (counts[WHITE][PAWNS])
+                return &Eval::evaluateKPXK<WHITE>;
+            if (counts[BLACK][PAWNS])
+                return &Eval::evaluateKPXK<BLACK>;
             // Two knights is a draw
-            if (count(pieces[WHITE][KNIGHTS]) == 2 || count(pieces[BLACK][KNIGHTS]) == 2)
-                return 0;
+            if (counts[WHITE][KNIGHTS] == 2 || counts[BLACK][KNIGHTS] == 2)
+                return &Eval::evaluateDraw;
             // Two bishops is a win
-            if (count(pieces[WHITE][BISHOPS]) == 2)
-                return scoreSimpleKnownWin(WHITE);
-            if (count(pieces[BLACK][BISHOPS]) == 2)
-                return scoreSimpleKnownWin(BLACK);
-
+            if (counts[WHITE][BISHOPS] == 2)
+                return &Eval::evaluateKXK<WHITE>;
+            if (counts[BLACK][BISHOPS] == 2)
+                return &Eval::evaluateKXK<BLACK>;
             // Mating with knight and bishop
-            if (pieces[WHITE][KNIGHTS] && pieces[WHITE][BISHOPS]) {
-                int value = KNOWN_WIN;
-                int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
-                int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
-                value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
-
-                // Light squared corners are H1 (7) and A8 (56)
-                if (pieces[WHITE][BISHOPS] & LIGHT)
-                    value -= 20 * (int)std::min(manhattanDistance[bKingSq][7], manhattanDistance[bKingSq][56]);
-                // Dark squared corners are A1 (0) and H8 (63)
-                else
-                    value -= 20 * (int)std::min(manhattanDistance[bKingSq][0], manhattanDistance[bKingSq][63]);
-                return value;
-            }
-            if (pieces[BLACK][KNIGHTS] && pieces[BLACK][BISHOPS]) {
-                int value = -KNOWN_WIN;
-                int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
-                int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
-                value += scoreCornerDistance(BLACK, wKingSq, bKingSq);
-
-                // Light squared corners are H1 (7) and A8 (56)
-                if (pieces[BLACK][BISHOPS] & LIGHT)
-                    value += 20 * (int)std::min(manhattanDistance[wKingSq][7], manhattanDistance[wKingSq][56]);
-                // Dark squared corners are A1 (0) and H8 (63)
-                else
-                    value += 20 * (int)std::min(manhattanDistance[wKingSq][0], manhattanDistance[wKingSq][63]);
-                return value;
-            }
+            if (counts[WHITE][KNIGHTS] && counts[WHITE][BISHOPS])
+                return &Eval::evaluateKBNK<WHITE>;
+            if (counts[BLACK][KNIGHTS] && counts[BLACK][BISHOPS])
+                return &Eval::evaluateKBNK<BLACK>;
         }
     }
 
-    // If not an endgame case, return -INFTY
-    return -INFTY;
+    return nullptr;
 }
 
 // A function for scoring the most basic mating cases, when it is only necessary
@@ -25,8 +25,6 @@
 
 class Board;
 
-void initEvalTables();
-void initDistances();
 void setMaterialScale(int s);
 void setKingSafetyScale(int s);
 
@@ -42,21 +40,103 @@ struct EvalInfo {
     }
 };
 
+// Pawn structure terms and bitboards that depend only on the pawns, cached
+// in the pawn hash table
+struct PawnHashEntry {
+    uint64_t pawnKey;
+    uint64_t attacks[2];
+    uint64_t rammedPawns[2];
+    uint64_t openFiles;
+    // Squares that pawns can attack in the future
+    uint64_t pawnStopAtt[2];
+    uint64_t passedPawns[2];
+    // Pawn structure score, including the rank and file bonuses of passers
+    Score score[2];
+    // Penalties for isolated and backward pawns on semi-open files, which only
+    // apply when the opponent has rooks or queens
+    Score semiopenScore[2];
+    int pawnAsymmetry;
+};
+
+constexpr int PAWN_HASH_SIZE = 16384;
+
+// A specialized evaluation function for an endgame material configuration
+class Eval;
+typedef int (Eval::*EndgameEvaluator)();
+
+// Terms that depend only on the number of each piece, cached in the material
+// hash table
+struct MaterialHashEntry {
+    uint64_t materialKey;
+    int pieceCounts[2][6];
+    // Material totals indexed by mg/eg, color
+    int material[2][2];
+    int egFactor;
+    // Imbalance score indexed by mg/eg, from white's perspective
+    int imbalance[2];
+    // The evaluator for known endgames, or nullptr if there is none
+    EndgameEvaluator endgameEvaluator;
+};
+
+constexpr int MATERIAL_HASH_SIZE = 8192;
+
+// Each search thread owns a pawn and a material hash table. Since an entry is
+// a function of its key alone, entries never become stale and are kept between
+// searches.
+struct EvalHashTables {
+    PawnHashEntry pawnEntries[PAWN_HASH_SIZE];
+    MaterialHashEntry materialEntries[MATERIAL_HASH_SIZE];
+
+    EvalHashTables() {
+        clear();
+    }
+
+    void clear() {
+        // Mark entries as empty. A key of 0 is a position without pawns or
+        // pieces, so use a key that is as unlikely as any other collision.
+        for (int i = 0; i < PAWN_HASH_SIZE; i++)
+            pawnEntries[i].pawnKey = ~0ULL;
+        for (int i = 0; i < MATERIAL_HASH_SIZE; i++)
+            materialEntries[i].materialKey = ~0ULL;
+    }
+
+    PawnHashEntry *getPawnEntry(uint64_t pawnKey) {
+        return &pawnEntries[pawnKey & (PAWN_HASH_SIZE - 1)];
+    }
+
+    MaterialHashEntry *getMaterialEntry(uint64_t materialKey) {
+        return &materialEntries[materialKey & (MATERIAL_HASH_SIZE - 1)];
+    }
+};
+
 class Eval {
 public:
+    Eval(EvalHashTables *_hashTables = nullptr) : hashTables(_hashTables) {}
+
     template <bool debug = false> int evaluate(Board &b);
 
 private:
+    // Pawn and material hash tables of the calling thread, or nullptr to skip
+    // caching
+    EvalHashTables *hashTables;
     EvalInfo ei;
     uint64_t pieces[2][6];
     uint64_t allPieces[2];
-    int pieceCounts[2][6];
+    // Points into the material hash entry for the position
+    const int (*pieceCounts)[6];
     int playerToMove;
 
     // Eval helpers
+    void evaluateMaterial(Board &b, MaterialHashEntry &me);
+    void evaluatePawns(Board &b, PawnHashEntry &pe);
     template <int attackingColor>
     int getKingSafety(Board &b, PieceMoveList &attackers, uint64_t kingSqs, int pawnScore, int kingFile);
-    int checkEndgameCases();
+    static EndgameEvaluator getEndgameEvaluator(const int counts[2][6]);
+    int evaluateDraw();
+    template <int color> int evaluateKXK();
+    template <int color> int evaluateKPK();
+    template <int color> int evaluateKPXK();
+    template <int color> int evaluateKBNK();
     int scoreSimpleKnownWin(int winningColor);
     int scoreCornerDistance(int winningColor, int wKingSq, int bKingSq);
 };
@@ -67,10 +147,6 @@ constexpr int EG_FACTOR_ALPHA = 2010;
 constexpr int EG_FACTOR_BETA = 6410;
 constexpr int EG_FACTOR_RES = 1000;
 
-// Eval scores are packed into an unsigned 32-bit integer during calculations
-// (the SWAR technique)
-typedef uint32_t Score;
-
 // Encodes 16-bit midgame and endgame evaluation scores into a single int
 #define E(mg, eg) ((Score) ((int32_t) (((uint32_t) eg) << 16) + ((int32_t) mg)))
 
@@ -297,6 +373,33 @@ constexpr int mobilityTable[2][5][28] = {
 }
 };
 
+// The full-board piece square table entry: the tables above cover the a-d
+// files from white's point of view, so they are mirrored across the center
+// files and flipped for black
+constexpr Score psqtValue(int color, int pieceID, int sq) {
+    return E(pieceSquareTable[MG][pieceID][4 * ((color == WHITE) ? 7 - (sq >> 3) : (sq >> 3))
+                                         + (((sq & 7) < 4) ? (sq & 7) : 7 - (sq & 7))],
+             pieceSquareTable[EG][pieceID][4 * ((color == WHITE) ? 7 - (sq >> 3) : (sq >> 3))
+                                         + (((sq & 7) < 4) ? (sq & 7) : 7 - (sq & 7))]);
+}
+
+template <class Indices> struct PsqtTable;
+template <int... Is> struct PsqtTable<IndexList<Is...>> {
+    static constexpr Score values[2][6][64] = {psqtValue(Is / 384, Is / 64 % 6, Is % 64)...};
+};
+template <int... Is> constexpr Score PsqtTable<IndexList<Is...>>::values[2][6][64];
+
+template <class Indices> struct MobilityTable;
+template <int... Is> struct MobilityTable<IndexList<Is...>> {
+    static constexpr Score values[5][28] = {E(mobilityTable[MG][Is / 28][Is % 28],
+                                              mobilityTable[EG][Is / 28][Is % 28])...};
+};
+template <int... Is> constexpr Score MobilityTable<IndexList<Is...>>::values[5][28];
+
+// Piece square tables, also used by the board to keep its scores up to date
+static constexpr const Score (&PSQT)[2][6][64] = PsqtTable<MakeIndexList<2 * 6 * 64>::type>::values;
+static constexpr const Score (&MOBILITY)[5][28] = MobilityTable<MakeIndexList<5 * 28>::type>::values;
+
 // Value of each square in the extended center in cp
 constexpr Score EXTENDED_CENTER_VAL = E(2, 0);
 // Additional bonus for squares in the center four squares in cp, in addition
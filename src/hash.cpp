@@ -16,101 +16,377 @@
     along with Laser.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <thread>
+#include <vector>
 #include "hash.h"
+#include "uci.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HASH_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char HASH_FILE_MAGIC[8] = {'L', 'A', 'S', 'E', 'R', 'T', 'T', '1'};
 
 Hash::Hash(uint64_t MB) {
+    clearThreads = 1;
     init(MB);
 }
 
 Hash::~Hash() {
-    free(table);
+    deallocate();
 }
 
 // Adds key and move into the hashtable. This function assumes that the key has
 // been checked with get and is not in the table.
-void Hash::add(Board &b, int score, Move move, int eval, int depth, uint8_t nodeType) {
+// The entry is built locally and then copied into the table, so that other
+// threads only ever see a complete entry or one that fails key verification.
+void Hash::add(Board &b, int score, Move move, int eval, int depth, uint8_t nodeType,
+    HashStatistics &stats) {
     uint64_t h = b.getZobristKey();
-    uint64_t index = h & (size-1);
-    HashNode *node = table + index;
+    HashNode *node = getBucket(h);
+    uint32_t key = HashEntry::keyFragment(h);
+
+    HashEntry entry;
+    entry.setEntry(b, score, move, eval, depth, nodeType, age);
+    stats.stores++;
+    int depthIndex = std::max(0, std::min(HASH_STAT_DEPTHS - 1, depth));
 
     // Decide whether to replace the entry
     // A more recent update to the same position should always be chosen
-    if (node->slot1.zobristKey == b.getZobristKey())
-        node->slot1.setEntry(b, score, move, eval, depth, nodeType, age);
-
-    else if (node->slot2.zobristKey == b.getZobristKey())
-        node->slot2.setEntry(b, score, move, eval, depth, nodeType, age);
+    for (int i = 0; i < HASH_BUCKET_ENTRIES; i++) {
+        // An empty slot verifies as key fragment 0, so it must be skipped
+        if (!node->slots[i].isEmpty() && node->slots[i].getKey() == key) {
+            node->slots[i] = entry;
+            stats.sameKeyOverwrites++;
+            stats.depthCounts[depthIndex]++;
+            return;
+        }
+    }
 
     // Replace an entry from a previous search space, or the lowest depth
     // entry with the new entry if the new entry's depth is high enough
-    else {
-        HashEntry *toReplace = &(node->slot1);
-        int score1 = 16 * ((int) ((uint8_t) (age - (node->slot1.ageNodeType >> 2))))
-            + depth - node->slot1.depth;
-        int score2 = 16 * ((int) ((uint8_t) (age - (node->slot2.ageNodeType >> 2))))
-            + depth - node->slot2.depth;
-        if (score1 < score2)
-            toReplace = &(node->slot2);
-        // The node must be from a newer search space or a sufficiently high depth
-        if (score1 >= -2 || score2 >= -2)
-            toReplace->setEntry(b, score, move, eval, depth, nodeType, age);
+    HashEntry *toReplace = nullptr;
+    int bestScore = -INFTY;
+    for (int i = 0; i < HASH_BUCKET_ENTRIES; i++) {
+        int replaceScore = 16 * ((age - (node->slots[i].ageNodeType >> 2)) & AGE_MASK)
+            + depth - node->slots[i].depth;
+        if (replaceScore > bestScore) {
+            bestScore = replaceScore;
+            toReplace = &(node->slots[i]);
+        }
     }
+    // The node must be from a newer search space or a sufficiently high depth
+    if (bestScore >= -2) {
+        if (toReplace->isEmpty())
+            stats.emptyWrites++;
+        else if ((toReplace->ageNodeType >> 2) != age)
+            stats.ageOverwrites++;
+        else
+            stats.depthOverwrites++;
+        stats.depthCounts[depthIndex]++;
+        *toReplace = entry;
+    }
+    else
+        stats.rejectedStores++;
 }
 
-// Get the hash entry, if any, associated with a board b.
-HashEntry *Hash::get(Board &b) {
+// Get the hash entry, if any, associated with a board b. The entry is copied
+// out of the table and verified, since another thread may be writing to the
+// same slot concurrently.
+bool Hash::get(Board &b, HashEntry &entry, HashStatistics &stats) const {
     uint64_t h = b.getZobristKey();
-    uint64_t index = h & (size-1);
-    HashNode *node = table + index;
+    HashNode *node = getBucket(h);
+    uint32_t key = HashEntry::keyFragment(h);
 
-    if (node->slot1.zobristKey == b.getZobristKey())
-        return &(node->slot1);
-    else if (node->slot2.zobristKey == b.getZobristKey())
-        return &(node->slot2);
+    stats.probes++;
+    for (int i = 0; i < HASH_BUCKET_ENTRIES; i++) {
+        entry = node->slots[i];
+        if (!entry.isEmpty() && entry.getKey() == key) {
+            stats.hits++;
+            return true;
+        }
+    }
 
-    return nullptr;
+    return false;
 }
 
 uint64_t Hash::getSize() const {
-    return (2 * size);
+    return (HASH_BUCKET_ENTRIES * size);
 }
 
 void Hash::setSize(uint64_t MB) {
-    free(table);
+    deallocate();
     init(MB);
 }
 
+const char *Hash::getAllocModeName() const {
+    switch (allocMode) {
+        case ALLOC_HUGE_PAGES_1GB:
+            return "1 GB huge pages";
+        case ALLOC_HUGE_PAGES_2MB:
+            return "2 MB huge pages";
+        case ALLOC_TRANSPARENT_HUGE_PAGES:
+            return "transparent huge pages";
+        case ALLOC_MAPPED_FILE:
+            return "a memory-mapped file";
+        default:
+            return "normal pages";
+    }
+}
+
 void Hash::init(uint64_t MB) {
     // Convert to bytes
     uint64_t bytes = MB << 20;
-    // Calculate how many array slots we can use
-    uint64_t maxSize = bytes / sizeof(HashNode);
-
-    size = 1;
-    while (size <= maxSize)
-        size <<= 1;
-    size >>= 1;
+    // Use as many buckets as fit, since indexing does not need a power of two
+    size = bytes / sizeof(HashNode);
 
-    table = (HashNode *) calloc(size,  sizeof(HashNode));
+    allocate(size * sizeof(HashNode));
     clear();
 }
 
+// Allocates the table, preferring huge pages to cut down on TLB misses when
+// probing a large table. Explicitly reserved huge pages are tried first, then
+// transparent huge pages, and finally ordinary cache line aligned memory.
+void Hash::allocate(uint64_t bytes) {
+    constexpr uint64_t HUGE_PAGE_2MB = 1ULL << 21;
+    tableMemBytes = bytes;
+
+#if defined(__linux__) && defined(MAP_HUGETLB)
+    // Only use 1 GB pages when no part of a page would be wasted
+#if defined(MAP_HUGE_1GB)
+    if (bytes >= (1ULL << 30) && bytes % (1ULL << 30) == 0) {
+        tableMem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+        if (tableMem != MAP_FAILED) {
+            allocMode = ALLOC_HUGE_PAGES_1GB;
+            table = (HashNode *) tableMem;
+            return;
+        }
+    }
+#endif
+    if (bytes >= HUGE_PAGE_2MB) {
+        // The mapping must be a whole number of pages
+        uint64_t hugeBytes = (bytes + HUGE_PAGE_2MB - 1) & ~(HUGE_PAGE_2MB - 1);
+        tableMem = mmap(nullptr, hugeBytes, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (tableMem != MAP_FAILED) {
+            tableMemBytes = hugeBytes;
+            allocMode = ALLOC_HUGE_PAGES_2MB;
+            table = (HashNode *) tableMem;
+            return;
+        }
+    }
+#endif
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    // Transparent huge pages can only back 2 MB aligned regions
+    if (bytes >= HUGE_PAGE_2MB && posix_memalign(&tableMem, HUGE_PAGE_2MB, bytes) == 0) {
+        allocMode = (madvise(tableMem, bytes, MADV_HUGEPAGE) == 0)
+                  ? ALLOC_TRANSPARENT_HUGE_PAGES : ALLOC_NORMAL;
+        table = (HashNode *) tableMem;
+        return;
+    }
+#endif
+
+    // Over-allocate by one node so that the table can be aligned to a cache line
+    allocMode = ALLOC_NORMAL;
+    tableMem = calloc(bytes + sizeof(HashNode), 1);
+    uintptr_t alignedAddress = ((uintptr_t) tableMem + alignof(HashNode) - 1)
+                             & ~((uintptr_t) alignof(HashNode) - 1);
+    table = (HashNode *) alignedAddress;
+}
+
+void Hash::deallocate() {
+#if defined(HASH_USE_MMAP)
+    if (allocMode == ALLOC_HUGE_PAGES_1GB || allocMode == ALLOC_HUGE_PAGES_2MB
+     || allocMode == ALLOC_MAPPED_FILE) {
+        munmap(tableMem, tableMemBytes);
+        return;
+    }
+#endif
+    free(tableMem);
+}
+
+// Writes the table, preceded by a header with its size and age, to a file.
+bool Hash::save(const std::string &fileName) const {
+    HashFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, HASH_FILE_MAGIC, sizeof(header.magic));
+    header.size = size;
+    header.nodeBytes = sizeof(HashNode);
+    header.bucketEntries = HASH_BUCKET_ENTRIES;
+    header.age = age;
+
+    std::FILE *f = std::fopen(fileName.c_str(), "wb");
+    if (f == nullptr)
+        return false;
+    bool success = std::fwrite(&header, sizeof(header), 1, f) == 1
+                && std::fwrite(table, sizeof(HashNode), size, f) == size;
+    return (std::fclose(f) == 0) && success;
+}
+
+// Replaces the table with one written by save. Where possible the file is
+// mapped copy-on-write, so that the table is usable immediately and searching
+// does not modify the file. The current table is kept if the file is invalid.
+bool Hash::load(const std::string &fileName) {
+    HashFileHeader header;
+    std::FILE *f = std::fopen(fileName.c_str(), "rb");
+    if (f == nullptr)
+        return false;
+    if (std::fread(&header, sizeof(header), 1, f) != 1
+     || std::memcmp(header.magic, HASH_FILE_MAGIC, sizeof(header.magic)) != 0
+     || header.nodeBytes != sizeof(HashNode)
+     || header.bucketEntries != HASH_BUCKET_ENTRIES
+     // Only accept sizes that setSize could have produced. This also keeps
+     // the file size below from overflowing, and estimateHashfull within
+     // the table.
+     || header.size < (MIN_HASH_SIZE << 20) / sizeof(HashNode)
+     || header.size > (MAX_HASH_SIZE << 20) / sizeof(HashNode)) {
+        std::fclose(f);
+        return false;
+    }
+
+    uint64_t fileBytes = sizeof(header) + header.size * sizeof(HashNode);
+#if defined(HASH_USE_MMAP)
+    std::fclose(f);
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0 || (uint64_t) fileInfo.st_size < fileBytes) {
+        close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+
+    deallocate();
+    tableMem = mapped;
+    tableMemBytes = fileBytes;
+    allocMode = ALLOC_MAPPED_FILE;
+    table = (HashNode *) ((char *) mapped + sizeof(header));
+#else
+    uint64_t oldSize = size;
+    deallocate();
+    allocate(header.size * sizeof(HashNode));
+    if (std::fread(table, sizeof(HashNode), header.size, f) != header.size) {
+        std::fclose(f);
+        // The old contents are gone, so fall back to an empty table
+        deallocate();
+        allocate(oldSize * sizeof(HashNode));
+        size = oldSize;
+        clear();
+        return false;
+    }
+    std::fclose(f);
+#endif
+
+    size = header.size;
+    age = header.age & AGE_MASK;
+    return true;
+}
+
 void Hash::incrementAge() {
-    age++;
+    age = (age + 1) & AGE_MASK;
 }
 
+void Hash::setClearThreads(int n) {
+    clearThreads = n;
+}
+
+// Zeroes the table, splitting the work across the search threads. Since the
+// table is allocated without being touched, the first clear also decides
+// which NUMA node each page lives on, so spreading it across threads spreads
+// the table across nodes.
 void Hash::clear() {
-    std::memset(static_cast<void*>(table), 0, size * sizeof(HashNode));
+    // Don't bother starting threads for small tables
+    constexpr uint64_t MIN_BYTES_PER_THREAD = 16ULL << 20;
+    uint64_t bytes = size * sizeof(HashNode);
+    int n = (int) std::min((uint64_t) clearThreads, bytes / MIN_BYTES_PER_THREAD);
+
+    if (n <= 1) {
+        std::memset(static_cast<void*>(table), 0, bytes);
+    }
+    else {
+        std::vector<std::thread> threads;
+        uint64_t nodesPerThread = size / n;
+        for (int i = 0; i < n; i++) {
+            HashNode *start = table + i * nodesPerThread;
+            uint64_t count = (i == n - 1) ? size - i * nodesPerThread : nodesPerThread;
+            threads.emplace_back([start, count]() {
+                std::memset(static_cast<void*>(start), 0, count * sizeof(HashNode));
+            });
+        }
+        for (std::thread &t : threads)
+            t.join();
+    }
     age = 0;
 }
 
 int Hash::estimateHashfull() const {
     int used = 0;
-    // This will never go out of bounds since a 1 MB table has 32768 slots
-    for (int i = 0; i < 500; i++) {
-        used += ((table + i)->slot1.ageNodeType >> 2) == age;
-        used += ((table + i)->slot2.ageNodeType >> 2) == age;
+    // Sample 1000 entries. This will never go out of bounds since a 1 MB table
+    // has 16384 buckets
+    for (int i = 0; i < 1000 / HASH_BUCKET_ENTRIES; i++) {
+        for (int j = 0; j < HASH_BUCKET_ENTRIES; j++)
+            used += !(table + i)->slots[j].isEmpty()
+                 && ((table + i)->slots[j].ageNodeType >> 2) == age;
     }
     return used;
 }
+
+
+EvalCache::EvalCache(uint64_t KB) {
+    table = nullptr;
+    setSize(KB);
+}
+
+EvalCache::~EvalCache() {
+    delete[] table;
+}
+
+// Resizes the table to the largest power of two number of entries that fits
+void EvalCache::setSize(uint64_t KB) {
+    delete[] table;
+    size = 1;
+    while (2 * size * sizeof(EvalCacheEntry) <= KB * 1024)
+        size *= 2;
+    table = new EvalCacheEntry[size];
+    clear();
+}
+
+void EvalCache::clear() {
+    // A static evaluation is never INFTY, so it marks an empty entry
+    for (uint64_t i = 0; i < size; i++) {
+        table[i].zobristKey = 0;
+        table[i].eval = INFTY;
+    }
+}
+
+
+PerftHash::PerftHash(uint64_t MB) {
+    size = 1;
+    while (2 * size * sizeof(PerftHashEntry) <= MB * 1024 * 1024)
+        size *= 2;
+    table = new PerftHashEntry[size];
+    clear();
+}
+
+PerftHash::~PerftHash() {
+    delete[] table;
+}
+
+void PerftHash::clear() {
+    // A depth of 0 is never stored, so zeroed entries never match
+    std::memset(table, 0, size * sizeof(PerftHashEntry));
+}
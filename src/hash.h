@@ -19,6 +19,8 @@
 #ifndef __HASH_H__
 #define __HASH_H__
 
+#include <cstring>
+#include <string>
 #include "board.h"
 #include "common.h"
 
@@ -26,12 +28,29 @@ constexpr uint8_t PV_NODE = 0;
 constexpr uint8_t CUT_NODE = 1;
 constexpr uint8_t ALL_NODE = 2;
 constexpr uint8_t NO_NODE_INFO = 3;
+// Search ages wrap at 64, since entries store them in the top 6 bits of
+// ageNodeType
+constexpr int AGE_MASK = 0x3F;
 
 
-// Struct storing hashed search information and corresponding hash key.
-// Size: 16 bytes
+constexpr int HASH_BUCKET_ENTRIES = 5;
+
+// How the memory backing the table was obtained
+enum HashAllocMode {
+    ALLOC_NORMAL, ALLOC_TRANSPARENT_HUGE_PAGES, ALLOC_HUGE_PAGES_2MB, ALLOC_HUGE_PAGES_1GB,
+    ALLOC_MAPPED_FILE
+};
+
+
+// Struct storing hashed search information and the lower 32 bits of the
+// corresponding hash key. The upper bits of the key are implied by the bucket
+// index.
+// The key is stored XORed with the 8 bytes of data so that an entry torn by
+// concurrent writes from another search thread fails verification, rather than
+// returning data belonging to a different position (lockless hashing).
+// Size: 12 bytes
 struct HashEntry {
-    uint64_t zobristKey;
+    uint32_t zobristKey;
     int16_t score;
     Move move;
     int16_t eval;
@@ -42,32 +61,151 @@ struct HashEntry {
     ~HashEntry() = default;
 
     void setEntry(Board &b, int _score, Move _move, int _eval, int _depth, uint8_t _nodeType, uint8_t _age) {
-        zobristKey = b.getZobristKey();
         score = (int16_t) _score;
         move = _move;
         eval = (int16_t) _eval;
         depth = (int8_t) _depth;
         ageNodeType = (_age << 2) | _nodeType;
+        zobristKey = keyFragment(b.getZobristKey()) ^ getDataCheck();
+    }
+
+    // Returns the non-key part of the entry folded into 32 bits
+    uint32_t getDataCheck() const {
+        uint64_t data;
+        std::memcpy(&data, reinterpret_cast<const char *>(this) + sizeof(uint32_t), sizeof(uint64_t));
+        return (uint32_t) (data ^ (data >> 32));
+    }
+
+    // The stored key only matches if the entry was not partially overwritten
+    uint32_t getKey() const {
+        return zobristKey ^ getDataCheck();
+    }
+
+    // Slots that have never been written to are all zero
+    bool isEmpty() const {
+        uint64_t data;
+        std::memcpy(&data, reinterpret_cast<const char *>(this) + sizeof(uint32_t), sizeof(uint64_t));
+        return zobristKey == 0 && data == 0;
+    }
+
+    // The bucket index comes from the upper bits of the key, so the lower
+    // bits are stored to tell apart positions in the same bucket
+    static uint32_t keyFragment(uint64_t h) {
+        return (uint32_t) h;
     }
 };
 
-// This contains each of the hash table entries, in a two-bucket system.
-class HashNode {
-public:
-    HashEntry slot1;
-    HashEntry slot2;
+static_assert(sizeof(HashEntry) == 12, "HashEntry must be 12 bytes");
+
+// Each bucket holds several entries and fills exactly one cache line, so that
+// a probe costs a single cache miss.
+struct alignas(64) HashNode {
+    HashEntry slots[HASH_BUCKET_ENTRIES];
+    uint8_t padding[64 - HASH_BUCKET_ENTRIES * sizeof(HashEntry)];
 
     HashNode() {}
     ~HashNode() {}
 };
 
+static_assert(sizeof(HashNode) == 64, "HashNode must be one cache line");
+
+// Stored depths at or above this are counted together in the depth histogram
+constexpr int HASH_STAT_DEPTHS = 32;
+
+// Counters describing how the table is used. Each search thread keeps its own
+// set so that no counter is shared between threads, and the sets are summed
+// when the statistics are reported.
+struct HashStatistics {
+    uint64_t probes;
+    uint64_t hits;
+    // Hash score cutoffs, indexed by the node type of the entry
+    uint64_t cutoffs[3];
+    uint64_t stores;
+    // Reason the stored entry was written over a slot
+    uint64_t emptyWrites;
+    uint64_t sameKeyOverwrites;
+    uint64_t ageOverwrites;
+    uint64_t depthOverwrites;
+    // Stores dropped because every slot held a deeper entry from this search
+    uint64_t rejectedStores;
+    // Depths of entries written to the table (rejected stores excluded),
+    // with all depths <= 0 counted at index 0
+    uint64_t depthCounts[HASH_STAT_DEPTHS];
+    // Static evaluation cache lookups
+    uint64_t evalCacheProbes;
+    uint64_t evalCacheHits;
+
+    HashStatistics() {
+        reset();
+    }
+
+    void reset() {
+        std::memset(this, 0, sizeof(HashStatistics));
+    }
+
+    HashStatistics &operator+=(const HashStatistics &other) {
+        probes += other.probes;
+        hits += other.hits;
+        for (int i = 0; i < 3; i++)
+            cutoffs[i] += other.cutoffs[i];
+        stores += other.stores;
+        emptyWrites += other.emptyWrites;
+        sameKeyOverwrites += other.sameKeyOverwrites;
+        ageOverwrites += other.ageOverwrites;
+        depthOverwrites += other.depthOverwrites;
+        rejectedStores += other.rejectedStores;
+        for (int i = 0; i < HASH_STAT_DEPTHS; i++)
+            depthCounts[i] += other.depthCounts[i];
+        evalCacheProbes += other.evalCacheProbes;
+        evalCacheHits += other.evalCacheHits;
+        return *this;
+    }
+};
+
+// Header written in front of the table by Hash::save. It is padded to a cache
+// line so that the table data stays aligned when the file is mapped.
+struct HashFileHeader {
+    char magic[8];
+    uint64_t size;
+    uint32_t nodeBytes;
+    uint32_t bucketEntries;
+    uint8_t age;
+    uint8_t padding[39];
+};
+
+static_assert(sizeof(HashFileHeader) == sizeof(HashNode), "HashFileHeader must be one cache line");
+
 class Hash {
 private:
+    // The memory block returned by the allocator, which may not be aligned
+    void *tableMem;
+    uint64_t tableMemBytes;
+    HashAllocMode allocMode;
     HashNode *table;
     uint64_t size;
+    // The search age, kept in the 6 bits stored in HashEntry::ageNodeType
     uint8_t age;
+    // Number of threads used to zero the table
+    int clearThreads;
 
     void init(uint64_t MB);
+    void allocate(uint64_t bytes);
+
+    // Maps a key to a bucket by taking the high 64 bits of key * size, which
+    // spreads keys evenly over a table of any size
+    HashNode *getBucket(uint64_t h) const {
+#if defined(__SIZEOF_INT128__)
+        __extension__ typedef unsigned __int128 uint128_t;
+        return table + (uint64_t) (((uint128_t) h * size) >> 64);
+#else
+        uint64_t hLo = (uint32_t) h, hHi = h >> 32;
+        uint64_t sLo = (uint32_t) size, sHi = size >> 32;
+        uint64_t mid = hHi * sLo + ((hLo * sLo) >> 32);
+        uint64_t mid2 = hLo * sHi + (uint32_t) mid;
+        return table + (hHi * sHi + (mid >> 32) + (mid2 >> 32));
+#endif
+    }
+    void deallocate();
 
 public:
     Hash(uint64_t MB);
@@ -75,11 +213,20 @@ public:
     Hash& operator=(const Hash &other) = delete;
     ~Hash();
 
-    void add(Board &b, int score, Move move, int eval, int depth, uint8_t nodeType);
-    HashEntry *get(Board &b);
+    void add(Board &b, int score, Move move, int eval, int depth, uint8_t nodeType,
+        HashStatistics &stats);
+    bool get(Board &b, HashEntry &entry, HashStatistics &stats) const;
+    // Starts loading the bucket for a key into cache ahead of a probe
+    void prefetch(uint64_t key) const {
+        __builtin_prefetch(getBucket(key));
+    }
 
     uint64_t getSize() const;
     void setSize(uint64_t MB);
+    const char *getAllocModeName() const;
+    bool save(const std::string &fileName) const;
+    bool load(const std::string &fileName);
+    void setClearThreads(int n);
 
     void incrementAge();
 
@@ -87,4 +234,94 @@ public:
     int estimateHashfull() const;
 };
 
+
+// Struct storing a static evaluation and the upper 32 bits of the position's
+// hash key. The lower bits of the key are implied by the table index.
+// Size: 8 bytes
+struct EvalCacheEntry {
+    uint32_t zobristKey;
+    int32_t eval;
+};
+
+/*
+ * A small, directly mapped table of static evaluations. Each search thread
+ * owns one, sized to stay in L2 cache, so that the transposition table only
+ * holds search results.
+ */
+class EvalCache {
+private:
+    EvalCacheEntry *table;
+    uint64_t size;
+
+public:
+    EvalCache(uint64_t KB);
+    EvalCache(const EvalCache &other) = delete;
+    EvalCache& operator=(const EvalCache &other) = delete;
+    ~EvalCache();
+
+    bool get(uint64_t key, int &eval, HashStatistics &stats) const {
+        stats.evalCacheProbes++;
+        const EvalCacheEntry &entry = table[key & (size - 1)];
+        if (entry.zobristKey != (uint32_t) (key >> 32) || entry.eval == INFTY)
+            return false;
+        eval = entry.eval;
+        stats.evalCacheHits++;
+        return true;
+    }
+
+    void add(uint64_t key, int eval) {
+        EvalCacheEntry &entry = table[key & (size - 1)];
+        entry.zobristKey = (uint32_t) (key >> 32);
+        entry.eval = eval;
+    }
+
+    void setSize(uint64_t KB);
+    void clear();
+};
+
+
+// Struct storing a perft subtree count. The key is stored XORed with the data
+// so that an entry torn by another perft thread fails verification.
+// Size: 16 bytes
+struct PerftHashEntry {
+    uint64_t zobristKey;
+    // Node count in the upper 56 bits, depth in the lower 8 bits
+    uint64_t data;
+};
+
+/*
+ * A directly mapped table of perft node counts, shared by all perft threads.
+ * Counts depend only on the position and the remaining depth, so entries stay
+ * valid from one perft run to the next.
+ */
+class PerftHash {
+private:
+    PerftHashEntry *table;
+    uint64_t size;
+
+public:
+    PerftHash(uint64_t MB);
+    PerftHash(const PerftHash &other) = delete;
+    PerftHash& operator=(const PerftHash &other) = delete;
+    ~PerftHash();
+
+    bool get(uint64_t key, int depth, uint64_t &nodes) const {
+        const PerftHashEntry &entry = table[key & (size - 1)];
+        uint64_t data = entry.data;
+        if ((entry.zobristKey ^ data) != key || (int) (data & 0xFF) != depth)
+            return false;
+        nodes = data >> 8;
+        return true;
+    }
+
+    void add(uint64_t key, int depth, uint64_t nodes) {
+        PerftHashEntry &entry = table[key & (size - 1)];
+        uint64_t data = (nodes << 8) | (uint64_t) depth;
+        entry.zobristKey = key ^ data;
+        entry.data = data;
+    }
+
+    void clear();
+};
+
 #endif
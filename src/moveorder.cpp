@@ -27,7 +27,8 @@ constexpr int16_t SCORE_LOSING_CAPTURE = -(1 << 14);
 
 
 MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
-    SearchStackInfo *_ssi, Move _hashed, MoveList _legalMoves) {
+    MoveBuffer *_buffer, SearchStackInfo *_ssi, Move _hashed, bool _isInCheck)
+    : legalMoves(_buffer->moves), scores(_buffer->scores) {
 	b = _b;
 	color = _color;
 	depth = _depth;
@@ -38,12 +39,16 @@ MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searc
     quietStart = 0;
     index = 0;
     hashed = _hashed;
-    legalMoves = _legalMoves;
+    isInCheck = _isInCheck;
     captureMargin = 0;
+    legalMoves.clear();
+    scores.clear();
 }
 
 MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
-    SearchStackInfo *_ssi, Move _hashed, MoveList _legalMoves, int _captureMargin) {
+    MoveBuffer *_buffer, SearchStackInfo *_ssi, Move _hashed, bool _isInCheck,
+    int _captureMargin)
+    : legalMoves(_buffer->moves), scores(_buffer->scores) {
     b = _b;
     color = _color;
     depth = _depth;
@@ -54,11 +59,15 @@ MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searc
     quietStart = 0;
     index = 0;
     hashed = _hashed;
-    legalMoves = _legalMoves;
+    isInCheck = _isInCheck;
     captureMargin = _captureMargin;
+    legalMoves.clear();
+    scores.clear();
 }
 
-MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams) {
+MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
+    MoveBuffer *_buffer)
+    : legalMoves(_buffer->moves), scores(_buffer->scores) {
     b = _b;
     color = _color;
     depth = _depth;
@@ -69,40 +78,51 @@ MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searc
     quietStart = 0;
     index = 0;
     hashed = NULL_MOVE;
+    isInCheck = false;
+    legalMoves.clear();
+    scores.clear();
 }
 
-// Returns true if there are still moves remaining, false if we have
-// generated all moves already
+// Generates and scores the moves of the next stage. Moves are only generated
+// once the previous stages have run out, so that nothing is generated at
+// nodes that cut off on the hash move or a capture.
 void MoveOrder::generateMoves() {
     switch (mgStage) {
-        // The hash move, if any, is handled separately from the rest of the list
+        // The hash move is tried first by nextMove(), before this is called
         case STAGE_NONE:
-            if (hashed != NULL_MOVE) {
-                mgStage = STAGE_HASH_MOVE;
-
-                // Remove the hash move from the list, since it has already been tried
-                for (unsigned int i = 0; i < legalMoves.size(); i++) {
-                    if (legalMoves.get(i) == hashed) {
-                        legalMoves.remove(i);
-                        break;
-                    }
-                }
-
-                break;
-            }
-            // else fallthrough
-
-        // If we just searched the hash move (or there is none), we need to find
-        // where the quiet moves start in the list, and then score captures.
         case STAGE_HASH_MOVE:
-            findQuietStart();
             mgStage = STAGE_CAPTURES;
+            // When in check, all escapes are generated at once and the quiet
+            // escapes are scored after the captures, killers included
+            if (isInCheck) {
+                b->getPseudoLegalCheckEscapes(legalMoves, color);
+                removeHashMove();
+                findQuietStart();
+            }
+            else {
+                b->getPseudoLegalCaptures(legalMoves, color, true);
+                removeHashMove();
+                quietStart = legalMoves.size();
+            }
             scoreCaptures();
             break;
 
-        // After winnning captures, we score quiets
+        // After winning captures, we try the killers, which are checked to
+        // be valid in this position
         case STAGE_CAPTURES:
+            if (!isInCheck) {
+                mgStage = STAGE_KILLERS;
+                addKiller(searchParams->killers[ssi->ply][0]);
+                addKiller(searchParams->killers[ssi->ply][1]);
+                break;
+            }
+            // else fallthrough
+
+        // Then we generate and score quiets
+        case STAGE_KILLERS:
             mgStage = STAGE_QUIETS;
+            if (!isInCheck)
+                b->getPseudoLegalQuiets(legalMoves, color);
             scoreQuiets();
             break;
 
@@ -146,6 +166,29 @@ void MoveOrder::generateMoves() {
     }
 }
 
+// Remove the hash move from the list, since it has already been tried
+void MoveOrder::removeHashMove() {
+    if (hashed == NULL_MOVE)
+        return;
+    for (unsigned int i = 0; i < legalMoves.size(); i++) {
+        if (legalMoves.get(i) == hashed) {
+            legalMoves.remove(i);
+            return;
+        }
+    }
+}
+
+// Adds a killer as the next move to be tried, if it is a different move from
+// the hash move and can be played here. Losing captures that were delayed
+// until after the quiets are kept behind it.
+void MoveOrder::addKiller(Move killer) {
+    if (killer == NULL_MOVE || killer == hashed || !b->isPseudoLegal(killer, color))
+        return;
+    scores.add(ScoredMove(killer, SCORE_QUEEN_PROMO - 1));
+    scores.swap(scoreSize, scores.size() - 1);
+    scoreSize++;
+}
+
 // Sort captures using SEE and MVV/LVA
 void MoveOrder::scoreCaptures() {
     for (unsigned int i = 0; i < quietStart; i++) {
@@ -166,6 +209,13 @@ void MoveOrder::scoreQuiets() {
     for (unsigned int i = quietStart; i < legalMoves.size(); i++) {
         Move m = legalMoves.get(i);
 
+        // Outside of check, the hash move and the killers have been tried in
+        // their own stages
+        if (!isInCheck && (m == hashed
+                        || m == searchParams->killers[ssi->ply][0]
+                        || m == searchParams->killers[ssi->ply][1]))
+            continue;
+
         // Score killers below even captures but above losing captures
         if (m == searchParams->killers[ssi->ply][0])
             scores.add(ScoredMove(m, SCORE_QUEEN_PROMO - 1));
@@ -195,9 +245,13 @@ void MoveOrder::scoreQuiets() {
 // partial selection sort. This way, the entire list does not have to be sorted
 // if an early cutoff occurs.
 Move MoveOrder::nextMove() {
-    // Special case when we have a hash move available
-    if (mgStage == STAGE_HASH_MOVE)
-        return hashed;
+    // The hash move is tried before anything is generated. It has not been
+    // checked for validity, which is left to Board::doHashMove().
+    if (mgStage == STAGE_NONE) {
+        mgStage = STAGE_HASH_MOVE;
+        if (hashed != NULL_MOVE)
+            return hashed;
+    }
 
     // If we are the end of our generated list, generate more.
     // If there are no moves left, return NULL_MOVE to indicate so.
@@ -233,6 +287,14 @@ Move MoveOrder::nextMove() {
     return scores.get(index++).m;
 }
 
+// Gravity update of a continuation history entry. The entry decays toward zero
+// in proportion to the size of the change, which keeps it within
+// +-resetFactor.
+inline void updateContinuationHistory(int16_t &entry, int change, int resetFactor) {
+    entry -= std::abs(change) * entry / resetFactor;
+    entry += change;
+}
+
 // When a PV or cut move is found, the history of the best move in increased,
 // and the histories of all moves searched prior to the best move are reduced.
 void MoveOrder::updateHistories(Move bestMove) {
@@ -248,16 +310,10 @@ void MoveOrder::updateHistories(Move bestMove) {
     searchParams->historyTable[color][pieceID][endSq] -=
         historyChange * searchParams->historyTable[color][pieceID][endSq] / resetFactor;
     searchParams->historyTable[color][pieceID][endSq] += historyChange;
-    if (ssi->counterMoveHistory != nullptr) {
-        ssi->counterMoveHistory[pieceID][endSq] -=
-            historyChange * ssi->counterMoveHistory[pieceID][endSq] / resetFactor;
-        ssi->counterMoveHistory[pieceID][endSq] += historyChange;
-    }
-    if (ssi->followupMoveHistory != nullptr) {
-        ssi->followupMoveHistory[pieceID][endSq] -=
-            historyChange * ssi->followupMoveHistory[pieceID][endSq] / resetFactor;
-        ssi->followupMoveHistory[pieceID][endSq] += historyChange;
-    }
+    if (ssi->counterMoveHistory != nullptr)
+        updateContinuationHistory(ssi->counterMoveHistory[pieceID][endSq], historyChange, resetFactor);
+    if (ssi->followupMoveHistory != nullptr)
+        updateContinuationHistory(ssi->followupMoveHistory[pieceID][endSq], historyChange, resetFactor);
 
     // If we searched only the hash move, return to prevent crashes
     if (index <= 0)
@@ -282,16 +338,10 @@ void MoveOrder::updateHistories(Move bestMove) {
             searchParams->historyTable[color][pieceID][endSq] -=
                 historyChange * searchParams->historyTable[color][pieceID][endSq] / resetFactor;
             searchParams->historyTable[color][pieceID][endSq] -= historyChange;
-            if (ssi->counterMoveHistory != nullptr) {
-                ssi->counterMoveHistory[pieceID][endSq] -=
-                    historyChange * ssi->counterMoveHistory[pieceID][endSq] / resetFactor;
-                ssi->counterMoveHistory[pieceID][endSq] -= historyChange;
-            }
-            if (ssi->followupMoveHistory != nullptr) {
-                ssi->followupMoveHistory[pieceID][endSq] -=
-                    historyChange * ssi->followupMoveHistory[pieceID][endSq] / resetFactor;
-                ssi->followupMoveHistory[pieceID][endSq] -= historyChange;
-            }
+            if (ssi->counterMoveHistory != nullptr)
+                updateContinuationHistory(ssi->counterMoveHistory[pieceID][endSq], -historyChange, resetFactor);
+            if (ssi->followupMoveHistory != nullptr)
+                updateContinuationHistory(ssi->followupMoveHistory[pieceID][endSq], -historyChange, resetFactor);
         }
     }
 }
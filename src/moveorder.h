@@ -25,7 +25,7 @@
 #include "searchparams.h"
 
 enum MoveGenStage {
-    STAGE_NONE, STAGE_HASH_MOVE, STAGE_CAPTURES, STAGE_QUIETS,
+    STAGE_NONE, STAGE_HASH_MOVE, STAGE_CAPTURES, STAGE_KILLERS, STAGE_QUIETS,
     STAGE_QS_CAPTURES, STAGE_QS_PROMOTIONS, STAGE_QS_CHECKS, STAGE_QS_DONE
 };
 
@@ -47,6 +47,13 @@ inline bool operator> (const ScoredMove &lhs, const ScoredMove &rhs) { return  o
 inline bool operator<=(const ScoredMove &lhs, const ScoredMove &rhs) { return !operator> (lhs,rhs); }
 inline bool operator>=(const ScoredMove &lhs, const ScoredMove &rhs) { return !operator< (lhs,rhs); }
 
+// Preallocated lists for the moves of one MoveOrder. The search threads own
+// one per ply, so that move lists are neither kept on the stack nor copied.
+struct MoveBuffer {
+    MoveList moves;
+    SearchArrayList<ScoredMove> scores;
+};
+
 struct MoveOrder {
     Board *b;
     int color;
@@ -55,26 +62,31 @@ struct MoveOrder {
     SearchStackInfo *ssi;
     MoveGenStage mgStage;
     Move hashed;
-    MoveList legalMoves;
-    SearchArrayList<ScoredMove> scores;
+    bool isInCheck;
+    MoveList &legalMoves;
+    SearchArrayList<ScoredMove> &scores;
     unsigned int scoreSize;
     unsigned int quietStart;
     unsigned int index;
     int captureMargin;
 
     MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
-        SearchStackInfo *_ssi, Move _hashed, MoveList _legalMoves);
+        MoveBuffer *_buffer, SearchStackInfo *_ssi, Move _hashed, bool _isInCheck);
     MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
-        SearchStackInfo *_ssi, Move _hashed, MoveList _legalMoves, int _captureMargin);
+        MoveBuffer *_buffer, SearchStackInfo *_ssi, Move _hashed, bool _isInCheck,
+        int _captureMargin);
     // Overloaded constructor for quiescence search
-    MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams);
+    MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
+        MoveBuffer *_buffer);
 
-    void generateMoves();
     Move nextMove();
     void updateHistories(Move bestMove);
     void updateCaptureHistories(Move bestMove);
 
 private:
+    void generateMoves();
+    void removeHashMove();
+    void addKiller(Move killer);
     void scoreCaptures();
     void scoreQuiets();
     void findQuietStart();
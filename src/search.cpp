@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
@@ -67,12 +68,27 @@ struct SearchPV {
 struct ThreadMemory {
     SearchParameters searchParams;
     SearchStatistics searchStats;
+    // Kept across searches, and only reset on request
+    HashStatistics hashStats;
+    EvalHashTables evalTables;
+    EvalCache evalCache;
     SearchStackInfo ssInfo[129];
     TwoFoldStack twoFoldPositions;
-
-    ThreadMemory() {
+    // Move lists for the search, indexed by ply, and for the q-search,
+    // indexed by q-search ply
+    MoveBuffer moveBuffers[MAX_DEPTH+1];
+    MoveBuffer qsMoveBuffers[MAX_DEPTH+1];
+    // The pool thread that searches with this memory. The flags are guarded
+    // by threadPoolMutex.
+    std::thread thread;
+    bool searching;
+    bool exiting;
+
+    ThreadMemory(uint64_t evalCacheKB) : evalCache(evalCacheKB) {
         for (int i = 0; i < 129; i++)
             ssInfo[i].ply = i;
+        searching = false;
+        exiting = false;
     }
 
     ~ThreadMemory() = default;
@@ -124,6 +140,21 @@ std::atomic<bool> isStop(true);
 // Additional stop signal to stop helper threads during SMP
 std::atomic<bool> stopSignal(true);
 
+// The search threads are kept between searches. Idle threads wait on
+// threadPoolCV until their searching flag is set, and searchDoneCV is
+// notified whenever a thread finishes.
+static std::mutex threadPoolMutex;
+static std::condition_variable threadPoolCV;
+static std::condition_variable searchDoneCV;
+// The position and limits of the current search
+static const Board *searchBoard;
+static TimeManagement *searchTimeParams;
+static MoveList *searchMovesToSearch;
+// The root moves and tablebase results, shared with the helper threads
+static MoveList helperRootMoves;
+static int helperTBScore;
+static bool helperTBProbeSuccess;
+
 // Dummy variables for lazy SMP since we don't care about these results
 int dummyBestIndex[MAX_THREADS-1];
 int dummyBestScore[MAX_THREADS-1];
@@ -131,13 +162,27 @@ int dummyBestScore[MAX_THREADS-1];
 // Values for UCI options
 unsigned int multiPV;
 int numThreads;
-bool isPonderSearch = false;
+static uint64_t evalCacheSize = DEFAULT_EVAL_CACHE_SIZE;
+std::atomic<bool> isPonderSearch(false);
+static std::atomic<bool> debugMode(false);
+
+// A finished ponder search waits on ponderCV until a stop or ponderhit
+// command. The flags are changed under ponderMutex so that no wakeup is lost.
+static std::mutex ponderMutex;
+static std::condition_variable ponderCV;
+// The last stop or ponderhit command of the current search, for debug output
+static const char *releaseCommand;
+static ChessTime releaseTime;
 
 // Accessible from tbcore.c
 int TBlargest = 0;
 static int probeLimit = 0;
 
 
+// Search threads
+void searchThreadLoop(ThreadMemory *memory, int threadID);
+void waitForHelpers();
+
 // Search functions
 void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves,
     int tbScore, bool tbProbeSuccess, int threadID);
@@ -247,20 +292,26 @@ void getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *m
     transpositionTable.incrementAge();
 
 
-    // Create threads for SMP if necessary
+    // Wake the helper threads for SMP if necessary, and search as thread 0
+    // on this thread
     if (numThreads > 1) {
-        std::thread *threadPool = new std::thread[numThreads];
-
-        // Start and join all threads
-        for (int i = 0; i < numThreads; i++) {
-            threadPool[i] = std::thread(getBestMove, b, timeParams, legalMoves, tbScore, tbProbeSuccess, i);
-        }
-        for (int i = 0; i < numThreads; i++) {
-            threadPool[i].join();
+        {
+            std::lock_guard<std::mutex> lock(threadPoolMutex);
+            searchBoard = b;
+            searchTimeParams = timeParams;
+            helperRootMoves = legalMoves;
+            helperTBScore = tbScore;
+            helperTBProbeSuccess = tbProbeSuccess;
+            for (int i = 1; i < numThreads; i++)
+                threadMemoryArray[i]->searching = true;
         }
+        threadPoolCV.notify_all();
+
+        getBestMove(b, timeParams, legalMoves, tbScore, tbProbeSuccess, 0);
 
-        stopSignal = false;
-        delete[] threadPool;
+        // Thread 0 has sent the stop signal, so the helpers finish shortly.
+        // The stop flags are left set until the next search resets them.
+        waitForHelpers();
     }
     // Otherwise, just search with one thread
     else {
@@ -268,6 +319,63 @@ void getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *m
     }
 }
 
+// Starts a search on the main search thread and returns immediately. The
+// best move is printed when the search ends.
+void startSearch(const Board *b, TimeManagement *timeParams, MoveList *movesToSearch) {
+    {
+        std::lock_guard<std::mutex> lock(threadPoolMutex);
+        searchBoard = b;
+        searchTimeParams = timeParams;
+        searchMovesToSearch = movesToSearch;
+        threadMemoryArray[0]->searching = true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(ponderMutex);
+        releaseCommand = nullptr;
+    }
+    threadPoolCV.notify_all();
+}
+
+// Blocks until the main search thread is idle
+void waitForSearch() {
+    std::unique_lock<std::mutex> lock(threadPoolMutex);
+    searchDoneCV.wait(lock, [] { return !threadMemoryArray[0]->searching; });
+}
+
+// Blocks until all helper threads are idle
+void waitForHelpers() {
+    std::unique_lock<std::mutex> lock(threadPoolMutex);
+    searchDoneCV.wait(lock, [] {
+        for (int i = 1; i < numThreads; i++) {
+            if (threadMemoryArray[i]->searching)
+                return false;
+        }
+        return true;
+    });
+}
+
+// The loop of a pool thread: wait for a search, run it, and report back.
+// Thread 0 runs the main search, and the others run helper searches.
+void searchThreadLoop(ThreadMemory *memory, int threadID) {
+    std::unique_lock<std::mutex> lock(threadPoolMutex);
+    while (true) {
+        threadPoolCV.wait(lock, [memory] { return memory->searching || memory->exiting; });
+        if (memory->exiting)
+            return;
+
+        lock.unlock();
+        if (threadID == 0)
+            getBestMoveThreader(searchBoard, searchTimeParams, searchMovesToSearch);
+        else
+            getBestMove(searchBoard, searchTimeParams, helperRootMoves,
+                helperTBScore, helperTBProbeSuccess, threadID);
+        lock.lock();
+
+        memory->searching = false;
+        searchDoneCV.notify_all();
+    }
+}
+
 // Finds a best move for a position according to the given search parameters.
 void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves,
         int tbScore, bool tbProbeSuccess, int threadID) {
@@ -527,13 +635,26 @@ void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves
            || (timeParams->searchMode == DEPTH && rootDepth <= timeParams->allotment))));
 
     // When pondering, we must continue "searching" until given a stop or ponderhit command.
-    while (isPonderSearch && !isStop)
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    if (isPonderSearch && !isStop) {
+        std::unique_lock<std::mutex> lock(ponderMutex);
+        ponderCV.wait(lock, [] { return !isPonderSearch || isStop; });
+    }
 
     // Send the stop signal, output best move and statistics to UCI interface
     if (threadID == 0) {
-        stopSignal = true;
-        isStop = true;
+        {
+            std::lock_guard<std::mutex> lock(ponderMutex);
+            stopSignal = true;
+            isStop = true;
+
+            if (debugMode && releaseCommand != nullptr) {
+                auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                    ChessClock::now() - releaseTime);
+                cout << "info string bestmove " << latency.count() << " us after "
+                     << releaseCommand << endl;
+            }
+        }
+        ponderCV.notify_all();
 
         if (ponder != NULL_MOVE)
             cout << "bestmove " << moveToString(bestMove) << " ponder " << moveToString(ponder) << endl;
@@ -646,6 +767,7 @@ void getBestMoveAtDepth(const Board *b, const MoveList *legalMoves, int depth, i
 int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode, SearchStackInfo *ssi, SearchPV *pvLine) {
     SearchParameters *searchParams = &(threadMemoryArray[threadID]->searchParams);
     SearchStatistics *searchStats = &(threadMemoryArray[threadID]->searchStats);
+    HashStatistics *hashStats = &(threadMemoryArray[threadID]->hashStats);
     // Reset the PV line
     pvLine->pvLength = 0;
     // When the standard search is done, enter quiescence search.
@@ -711,12 +833,13 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     int hashDepth = 0;
     uint8_t nodeType = NO_NODE_INFO;
 
-    HashEntry *hashEntry = transpositionTable.get(b);
-    if (hashEntry != nullptr) {
-        hashScore = hashEntry->score;
-        nodeType = hashEntry->ageNodeType & 0x3;
-        hashDepth = hashEntry->depth;
-        hashed = hashEntry->move;
+    HashEntry hashEntry;
+    bool hashHit = transpositionTable.get(b, hashEntry, *hashStats);
+    if (hashHit) {
+        hashScore = hashEntry.score;
+        nodeType = hashEntry.ageNodeType & 0x3;
+        hashDepth = hashEntry.depth;
+        hashed = hashEntry.move;
 
         // Count hashed tb hits
         if (nodeType == PV_NODE && hashed == NULL_MOVE)
@@ -739,6 +862,7 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
                 if ((nodeType == ALL_NODE && hashScore <= alpha)
                  || (nodeType == CUT_NODE && hashScore >= beta)
                  || (nodeType == PV_NODE)) {
+                    hashStats->cutoffs[nodeType]++;
                     return hashScore;
                 }
             }
@@ -765,7 +889,7 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
 
             // Hash the TB result
             int tbDepth = std::min(depth+4, MAX_DEPTH);
-            transpositionTable.add(b, adjustHashScore(tbScore, ssi->ply), NULL_MOVE, INFTY, tbDepth, PV_NODE);
+            transpositionTable.add(b, adjustHashScore(tbScore, ssi->ply), NULL_MOVE, INFTY, tbDepth, PV_NODE, *hashStats);
 
             return tbScore;
         }
@@ -781,13 +905,17 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     ssi->staticEval = INFTY;
     if (!isInCheck) {
         // Check the hash entry for a saved evaluation
-        if (hashEntry != nullptr && hashEntry->eval != INFTY) {
-            ssi->staticEval = staticEval = hashEntry->eval;
+        if (hashHit && hashEntry.eval != INFTY) {
+            ssi->staticEval = staticEval = hashEntry.eval;
+        }
+        // Then the eval cache
+        else if (threadMemoryArray[threadID]->evalCache.get(b.getZobristKey(), staticEval, *hashStats)) {
+            ssi->staticEval = staticEval;
         }
         else {
-            Eval e;
+            Eval e(&(threadMemoryArray[threadID]->evalTables));
             ssi->staticEval = staticEval = (color == WHITE) ? e.evaluate(b) : -e.evaluate(b);
-            transpositionTable.add(b, -INFTY, NULL_MOVE, staticEval, -8, NO_NODE_INFO);
+            threadMemoryArray[threadID]->evalCache.add(b.getZobristKey(), staticEval);
         }
     }
 
@@ -869,14 +997,6 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     }
 
 
-    // Create list of legal moves
-    MoveList legalMoves;
-    if (isInCheck)
-        b.getPseudoLegalCheckEscapes(legalMoves, color);
-    else
-        b.getAllPseudoLegalMoves(legalMoves, color);
-
-
     // ProbCut
     // If a winning capture scores much higher than beta on a shallow search,
     // then we can assume a beta cutoff would happen on the full search as
@@ -887,23 +1007,25 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
      && abs(beta) < MAX_PLY_MATE_SCORE) {
         int probCutMargin = beta + 90;
         int probCutCount = 0;
-        MoveOrder moveSorter(&b, color, depth, searchParams, ssi, NULL_MOVE, legalMoves, probCutMargin - staticEval);
-        moveSorter.generateMoves();
+        MoveOrder moveSorter(&b, color, depth, searchParams, &(threadMemoryArray[threadID]->moveBuffers[ssi->ply]),
+            ssi, NULL_MOVE, false, probCutMargin - staticEval);
 
         for (Move m = moveSorter.nextMove(); m != NULL_MOVE && probCutCount < 3 && isCapture(m);
                   m = moveSorter.nextMove()) {
             probCutCount++;
-            Board copy = b.staticCopy();
             // Search every move except the hash move
             if (m == hashed)
                 continue;
-            if (!copy.doPseudoLegalMove(m, color))
+            int pieceID = b.getPieceOnSquare(color, getStartSq(m));
+            UndoInfo undo;
+            if (!b.doPseudoLegalMove(m, color, undo))
                 continue;
 
-            (ssi+1)->counterMoveHistory = searchParams->counterMoveHistory[b.getPieceOnSquare(color, getStartSq(m))][getEndSq(m)];
-            (ssi+2)->followupMoveHistory = searchParams->followupMoveHistory[b.getPieceOnSquare(color, getStartSq(m))][getEndSq(m)];
+            (ssi+1)->counterMoveHistory = searchParams->counterMoveHistory[pieceID][getEndSq(m)];
+            (ssi+2)->followupMoveHistory = searchParams->followupMoveHistory[pieceID][getEndSq(m)];
 
-            int score = -PVS(copy, depth - depth/4 - 4, -probCutMargin, -probCutMargin+1, threadID, !isCutNode, ssi+1, &line);
+            int score = -PVS(b, depth - depth/4 - 4, -probCutMargin, -probCutMargin+1, threadID, !isCutNode, ssi+1, &line);
+            b.undoMove(m, undo);
 
             if (score >= probCutMargin)
                 return score;
@@ -921,19 +1043,20 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
         int iidDepth = isPVNode ? depth - depth/4 - 1 : (depth - 5) / 2;
         PVS(b, iidDepth, alpha, beta, threadID, isCutNode, ssi, &line);
 
-        HashEntry *iidEntry = transpositionTable.get(b);
-        if (iidEntry != nullptr) {
-            hashScore = iidEntry->score;
-            nodeType = iidEntry->ageNodeType & 0x3;
-            hashDepth = iidEntry->depth;
-            hashed = iidEntry->move;
+        HashEntry iidEntry;
+        if (transpositionTable.get(b, iidEntry, *hashStats)) {
+            hashScore = iidEntry.score;
+            nodeType = iidEntry.ageNodeType & 0x3;
+            hashDepth = iidEntry.depth;
+            hashed = iidEntry.move;
         }
     }
 
 
-    // Initialize the module for move ordering
-    MoveOrder moveSorter(&b, color, depth, searchParams, ssi, hashed, legalMoves);
-    moveSorter.generateMoves();
+    // Initialize the module for move ordering. Moves are generated in stages
+    // as they are needed, starting with the hash move.
+    MoveOrder moveSorter(&b, color, depth, searchParams, &(threadMemoryArray[threadID]->moveBuffers[ssi->ply]),
+        ssi, hashed, isInCheck);
 
     // Keeps track of the best move for storing into the TT
     Move toHash = NULL_MOVE;
@@ -946,6 +1069,12 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     //----------------------------Main search loop------------------------------
     for (Move m = moveSorter.nextMove(); m != NULL_MOVE;
               m = moveSorter.nextMove()) {
+        // Prefetch the child's hash entry so that the memory access overlaps
+        // with the pruning decisions below. The hash move has not been
+        // verified yet, so its key cannot be computed safely.
+        if (m != hashed)
+            transpositionTable.prefetch(b.getZobristKeyAfterMove(m, color));
+
         bool isCheckMove = b.isCheckMove(color, m);
         // Conditions for whether to do futility and move count pruning
         bool moveIsPrunable = !isCapture(m)
@@ -1012,20 +1141,24 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
             continue;
 
 
-        // Copy the board and do the move
-        Board copy = b.staticCopy();
+        // Whether to extend checks must be decided on the current position
+        bool isGoodCheck = !doMoveCountPruning
+                        && isCheckMove
+                        && b.isSEEAbove(color, m, 0);
+
+        // Do the move
+        UndoInfo undo;
         // If we are searching the hash move, we must use to a special
-        // move generator for extra verification.
+        // move generator for extra verification. No other moves have been
+        // generated yet.
         if (m == hashed) {
-            if (!copy.doHashMove(m, color)) {
+            if (!b.doHashMove(m, color, undo)) {
                 hashed = NULL_MOVE;
                 moveSorter.hashed = NULL_MOVE;
-                moveSorter.generateMoves();
                 continue;
             }
-            moveSorter.generateMoves();
         }
-        else if (!copy.doPseudoLegalMove(m, color))
+        else if (!b.doPseudoLegalMove(m, color, undo))
             continue;
         searchStats->nodes++;
 
@@ -1065,14 +1198,11 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
 
         int extension = 0;
         // Check extensions
-        if (!doMoveCountPruning
-         && isCheckMove
-         && b.isSEEAbove(color, m, 0)) {
+        if (isGoodCheck)
             extension++;
-        }
 
         // Record two-fold stack since we may do a search for singular extensions
-        threadMemoryArray[threadID]->twoFoldPositions.push(b.getZobristKey());
+        threadMemoryArray[threadID]->twoFoldPositions.push(undo.zobristKey);
 
         // Singular extensions
         // If the TT move appears to be much better than all others, extend the move
@@ -1082,28 +1212,38 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
          && (nodeType == CUT_NODE || nodeType == PV_NODE)
          && hashDepth >= depth - 3) {
             bool isSingular = true;
+            // The other moves are searched from the current position, so take
+            // back the hash move for now. It is known to be legal.
+            b.undoMove(m, undo);
 
             // Do a reduced depth search with a lowered window for a fail low check
-            for (unsigned int i = 0; i < legalMoves.size(); i++) {
-                Move seMove = legalMoves.get(i);
-                Board seCopy = b.staticCopy();
+            MoveList seMoves;
+            if (isInCheck)
+                b.getPseudoLegalCheckEscapes(seMoves, color);
+            else
+                b.getAllPseudoLegalMoves(seMoves, color);
+            for (unsigned int i = 0; i < seMoves.size(); i++) {
+                Move seMove = seMoves.get(i);
                 // Search every move except the hash move
                 if (seMove == hashed)
                     continue;
-                if (!seCopy.doPseudoLegalMove(seMove, color))
+                int sePieceID = b.getPieceOnSquare(color, getStartSq(seMove));
+                UndoInfo seUndo;
+                if (!b.doPseudoLegalMove(seMove, color, seUndo))
                     continue;
 
                 (ssi+1)->counterMoveHistory = searchParams->counterMoveHistory
-                    [b.getPieceOnSquare(color, getStartSq(seMove))][getEndSq(seMove)];
+                    [sePieceID][getEndSq(seMove)];
                 (ssi+2)->followupMoveHistory = searchParams->followupMoveHistory
-                    [b.getPieceOnSquare(color, getStartSq(seMove))][getEndSq(seMove)];
+                    [sePieceID][getEndSq(seMove)];
 
                 // The window is lowered more for higher depths
                 int SEWindow = hashScore - depth;
                 // Do a reduced search for fail-low confirmation
                 int SEDepth = depth / 2 - 1;
 
-                score = -PVS(seCopy, SEDepth, -SEWindow - 1, -SEWindow, threadID, !isCutNode, ssi+1, &line);
+                score = -PVS(b, SEDepth, -SEWindow - 1, -SEWindow, threadID, !isCutNode, ssi+1, &line);
+                b.undoMove(seMove, seUndo);
 
                 // If a move did not fail low, no singular extension
                 if (score > SEWindow) {
@@ -1119,6 +1259,8 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
             // the singular move
             if (isSingular)
                 extension++;
+
+            b.doMove(m, color, undo);
         }
 
 
@@ -1127,24 +1269,26 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
 
         // Null-window search, with re-search if applicable
         if (movesSearched > 1) {
-            score = -PVS(copy, depth-1-reduction+extension, -alpha-1, -alpha, threadID, true, ssi+1, &line);
+            score = -PVS(b, depth-1-reduction+extension, -alpha-1, -alpha, threadID, true, ssi+1, &line);
 
             // LMR re-search if the reduced search did not fail low
             if (reduction > 0 && score > alpha) {
-                score = -PVS(copy, depth-1+extension, -alpha-1, -alpha, threadID, !isCutNode, ssi+1, &line);
+                score = -PVS(b, depth-1+extension, -alpha-1, -alpha, threadID, !isCutNode, ssi+1, &line);
             }
 
             // Re-search for a scout window at PV nodes
             if (alpha < score && score < beta) {
-                score = -PVS(copy, depth-1+extension, -beta, -alpha, threadID, false, ssi+1, &line);
+                score = -PVS(b, depth-1+extension, -beta, -alpha, threadID, false, ssi+1, &line);
             }
         }
 
         // The first move is always searched at a normal depth
         else {
-            score = -PVS(copy, depth-1+extension, -beta, -alpha, threadID, (isPVNode ? false : !isCutNode), ssi+1, &line);
+            score = -PVS(b, depth-1+extension, -beta, -alpha, threadID, (isPVNode ? false : !isCutNode), ssi+1, &line);
         }
 
+        b.undoMove(m, undo);
+
         // Pop the position in case we return early from this search
         threadMemoryArray[threadID]->twoFoldPositions.pop();
 
@@ -1155,7 +1299,7 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
         // Beta cutoff
         if (score >= beta) {
             // Hash the cut move and score
-            transpositionTable.add(b, adjustHashScore(score, ssi->ply), m, ssi->staticEval, depth, CUT_NODE);
+            transpositionTable.add(b, adjustHashScore(score, ssi->ply), m, ssi->staticEval, depth, CUT_NODE, *hashStats);
 
             // Update killers and histories for quiet moves
             if (!isCapture(m)) {
@@ -1194,7 +1338,7 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
 
     // Exact scores indicate a principal variation
     if (prevAlpha < alpha && alpha < beta) {
-        transpositionTable.add(b, adjustHashScore(alpha, ssi->ply), toHash, ssi->staticEval, depth, PV_NODE);
+        transpositionTable.add(b, adjustHashScore(alpha, ssi->ply), toHash, ssi->staticEval, depth, PV_NODE, *hashStats);
 
         // Update histories for quiet moves
         if (!isCapture(toHash))
@@ -1207,11 +1351,11 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     else if (alpha <= prevAlpha) {
         // If we had a hash move, save it in case the node becomes a PV or cut node next time
         if (!isPVNode && hashed != NULL_MOVE) {
-            transpositionTable.add(b, adjustHashScore(bestScore, ssi->ply), hashed, ssi->staticEval, depth, ALL_NODE);
+            transpositionTable.add(b, adjustHashScore(bestScore, ssi->ply), hashed, ssi->staticEval, depth, ALL_NODE, *hashStats);
         }
         // Otherwise, just store no best move as expected
         else {
-            transpositionTable.add(b, adjustHashScore(bestScore, ssi->ply), NULL_MOVE, ssi->staticEval, depth, ALL_NODE);
+            transpositionTable.add(b, adjustHashScore(bestScore, ssi->ply), NULL_MOVE, ssi->staticEval, depth, ALL_NODE, *hashStats);
         }
     }
 
@@ -1229,8 +1373,16 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
 int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
     SearchParameters *searchParams = &(threadMemoryArray[threadID]->searchParams);
     SearchStatistics *searchStats = &(threadMemoryArray[threadID]->searchStats);
+    HashStatistics *hashStats = &(threadMemoryArray[threadID]->hashStats);
     int color = b.getPlayerToMove();
 
+    // The q-search move buffers end here. Captures run out long before this,
+    // but if it is ever reached, stand pat on the static eval.
+    if (plies >= MAX_DEPTH) {
+        Eval e(&(threadMemoryArray[threadID]->evalTables));
+        return (color == WHITE) ? e.evaluate(b) : -e.evaluate(b);
+    }
+
     // If in check, we must consider all legal check evasions
     if (b.isInCheck(color))
         return checkQuiescence(b, plies, alpha, beta, threadID);
@@ -1247,10 +1399,11 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
 
     // Qsearch hash table probe
     int hashScore = -INFTY;
-    HashEntry *hashEntry = transpositionTable.get(b);
+    HashEntry hashEntry;
+    bool hashHit = transpositionTable.get(b, hashEntry, *hashStats);
     uint8_t nodeType = NO_NODE_INFO;
-    if (hashEntry != nullptr) {
-        hashScore = hashEntry->score;
+    if (hashHit) {
+        hashScore = hashEntry.score;
 
         if (hashScore != -INFTY) {
             // Adjust the hash score to mate distance from root if necessary
@@ -1259,15 +1412,17 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
             else if (hashScore <= -MAX_PLY_MATE_SCORE)
                 hashScore += searchParams->ply + plies;
 
-            nodeType = hashEntry->ageNodeType & 0x3;
+            nodeType = hashEntry.ageNodeType & 0x3;
             // Only used a hashed score if the search depth was at least
             // the current depth
-            if (hashEntry->depth >= -plies) {
+            if (hashEntry.depth >= -plies) {
                 // Check for the correct node type and bounds
                 if ((nodeType == ALL_NODE && hashScore <= alpha)
                  || (nodeType == CUT_NODE && hashScore >= beta)
-                 || (nodeType == PV_NODE))
+                 || (nodeType == PV_NODE)) {
+                    hashStats->cutoffs[nodeType]++;
                     return hashScore;
+                }
             }
         }
     }
@@ -1276,20 +1431,17 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
     // Stand pat: if our current position is already way too good or way too bad
     // we can simply stop the search here.
     int hashEval, staticEval;
-    // Check the hash entry for a saved evaluation
-    if (hashEntry != nullptr) {
-        if (hashEntry->eval != INFTY) {
-            hashEval = staticEval = hashEntry->eval;
-        }
-        else {
-            Eval e;
-            hashEval = staticEval = (color == WHITE) ? e.evaluate(b) : -e.evaluate(b);
-        }
+    // Check the hash entry for a saved evaluation, then the eval cache
+    if (hashHit && hashEntry.eval != INFTY) {
+        hashEval = staticEval = hashEntry.eval;
+    }
+    else if (threadMemoryArray[threadID]->evalCache.get(b.getZobristKey(), hashEval, *hashStats)) {
+        staticEval = hashEval;
     }
     else {
-        Eval e;
+        Eval e(&(threadMemoryArray[threadID]->evalTables));
         hashEval = staticEval = (color == WHITE) ? e.evaluate(b) : -e.evaluate(b);
-        transpositionTable.add(b, -INFTY, NULL_MOVE, hashEval, -8, NO_NODE_INFO);
+        threadMemoryArray[threadID]->evalCache.add(b.getZobristKey(), hashEval);
     }
 
     // Use the TT score as a better "static" eval, if available.
@@ -1311,8 +1463,7 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
 
 
     // Initialize the module for move ordering
-    MoveOrder moveSorter(&b, color, -plies, searchParams);
-    moveSorter.generateMoves();
+    MoveOrder moveSorter(&b, color, -plies, searchParams, &(threadMemoryArray[threadID]->qsMoveBuffers[plies]));
 
     for (Move m = moveSorter.nextMove(); m != NULL_MOVE;
               m = moveSorter.nextMove()) {
@@ -1330,16 +1481,17 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
         if (!b.isSEEAbove(color, m, 0))
             continue;
 
-        Board copy = b.staticCopy();
-        if (!copy.doPseudoLegalMove(m, color))
+        UndoInfo undo;
+        if (!b.doPseudoLegalMove(m, color, undo))
             continue;
 
         searchStats->nodes++;
-        int score = isCheckMove ? -checkQuiescence(copy, plies+1, -beta, -alpha, threadID)
-                                : -quiescence(copy, plies+1, -beta, -alpha, threadID);
+        int score = isCheckMove ? -checkQuiescence(b, plies+1, -beta, -alpha, threadID)
+                                : -quiescence(b, plies+1, -beta, -alpha, threadID);
+        b.undoMove(m, undo);
 
         if (score >= beta) {
-            transpositionTable.add(b, adjustHashScore(score, searchParams->ply + plies), m, hashEval, -plies, CUT_NODE);
+            transpositionTable.add(b, adjustHashScore(score, searchParams->ply + plies), m, hashEval, -plies, CUT_NODE, *hashStats);
             return score;
         }
 
@@ -1364,8 +1516,9 @@ int checkQuiescence(Board &b, int plies, int alpha, int beta, int threadID) {
     SearchParameters *searchParams = &(threadMemoryArray[threadID]->searchParams);
     SearchStatistics *searchStats = &(threadMemoryArray[threadID]->searchStats);
     int color = b.getPlayerToMove();
-    MoveList legalMoves;
-    b.getPseudoLegalCheckEscapes(legalMoves, color);
+    MoveList &legalMoves = threadMemoryArray[threadID]->qsMoveBuffers[plies].moves;
+    legalMoves.clear();
+    b.getLegalCheckEscapes(legalMoves, color);
 
     int bestScore = -INFTY;
     int score = -INFTY;
@@ -1377,16 +1530,16 @@ int checkQuiescence(Board &b, int plies, int alpha, int beta, int threadID) {
          && !b.isSEEAbove(color, m, 0))
             continue;
 
-        Board copy = b.staticCopy();
-        if (!copy.doPseudoLegalMove(m, color))
-            continue;
+        UndoInfo undo;
+        b.doMove(m, color, undo);
 
         searchStats->nodes++;
-        threadMemoryArray[threadID]->twoFoldPositions.push(b.getZobristKey());
+        threadMemoryArray[threadID]->twoFoldPositions.push(undo.zobristKey);
 
-        score = -quiescence(copy, plies+1, -beta, -alpha, threadID);
+        score = -quiescence(b, plies+1, -beta, -alpha, threadID);
 
         threadMemoryArray[threadID]->twoFoldPositions.pop();
+        b.undoMove(m, undo);
 
         if (score >= beta)
             return score;
@@ -1440,8 +1593,34 @@ void startPonder() {
     isPonderSearch = true;
 }
 
+// Called on ponderhit. A search that has already finished sends its best
+// move immediately.
 void stopPonder() {
-    isPonderSearch = false;
+    {
+        std::lock_guard<std::mutex> lock(ponderMutex);
+        isPonderSearch = false;
+        releaseCommand = "ponderhit";
+        releaseTime = ChessClock::now();
+    }
+    ponderCV.notify_all();
+}
+
+// Signals all search threads to stop, waking any waiting ponder search. Does
+// not wait for the search to end.
+void stopSearch() {
+    {
+        std::lock_guard<std::mutex> lock(ponderMutex);
+        isPonderSearch = false;
+        isStop = true;
+        stopSignal = true;
+        releaseCommand = "stop";
+        releaseTime = ChessClock::now();
+    }
+    ponderCV.notify_all();
+}
+
+void setDebugMode(bool on) {
+    debugMode = on;
 }
 
 
@@ -1452,12 +1631,78 @@ void stopPonder() {
 // These functions help to communicate with uci.cpp
 void clearTables() {
     transpositionTable.clear();
-    for (int i = 0; i < numThreads; i++)
+    for (int i = 0; i < numThreads; i++) {
         threadMemoryArray[i]->searchParams.resetHistoryTable();
+        threadMemoryArray[i]->evalCache.clear();
+    }
 }
 
 void setHashSize(uint64_t MB) {
     transpositionTable.setSize(MB);
+    printHashAllocation();
+}
+
+// Reports the size of the transposition table and how its memory was obtained
+void printHashAllocation() {
+    uint64_t MB = (transpositionTable.getSize() / HASH_BUCKET_ENTRIES * sizeof(HashNode)) >> 20;
+    cout << "info string Hash " << MB << " MB allocated using "
+         << transpositionTable.getAllocModeName() << endl;
+}
+
+void setEvalCacheSize(uint64_t KB) {
+    evalCacheSize = KB;
+    for (int i = 0; i < numThreads; i++)
+        threadMemoryArray[i]->evalCache.setSize(KB);
+}
+
+bool saveHash(const std::string &fileName) {
+    return transpositionTable.save(fileName);
+}
+
+bool loadHash(const std::string &fileName) {
+    return transpositionTable.load(fileName);
+}
+
+uint64_t getHashSize() {
+    return transpositionTable.getSize();
+}
+
+void resetHashStatistics() {
+    for (int i = 0; i < numThreads; i++)
+        threadMemoryArray[i]->hashStats.reset();
+}
+
+// Sums the hash statistics of all threads and prints them in info strings
+void printHashStatistics() {
+    HashStatistics total;
+    for (int i = 0; i < numThreads; i++)
+        total += threadMemoryArray[i]->hashStats;
+
+    uint64_t probes = std::max((uint64_t) 1, total.probes);
+    cout << "info string hash probes " << total.probes << " hits " << total.hits
+         << " (" << 100 * total.hits / probes << "%) hashfull "
+         << transpositionTable.estimateHashfull() << endl;
+    cout << "info string hash cutoffs pv " << total.cutoffs[PV_NODE]
+         << " cut " << total.cutoffs[CUT_NODE]
+         << " all " << total.cutoffs[ALL_NODE] << endl;
+    cout << "info string hash stores " << total.stores
+         << " empty " << total.emptyWrites
+         << " samekey " << total.sameKeyOverwrites
+         << " age " << total.ageOverwrites
+         << " depth " << total.depthOverwrites
+         << " rejected " << total.rejectedStores << endl;
+    uint64_t evalProbes = std::max((uint64_t) 1, total.evalCacheProbes);
+    cout << "info string eval cache probes " << total.evalCacheProbes
+         << " hits " << total.evalCacheHits
+         << " (" << 100 * total.evalCacheHits / evalProbes << "%)" << endl;
+    cout << "info string hash store depths";
+    for (int i = 0; i < HASH_STAT_DEPTHS; i++) {
+        if (total.depthCounts[i] == 0)
+            continue;
+        cout << " " << (i == 0 ? "<=" : "") << i << (i == HASH_STAT_DEPTHS - 1 ? "+" : "")
+             << ":" << total.depthCounts[i];
+    }
+    cout << endl;
 }
 
 uint64_t getNodes() {
@@ -1480,19 +1725,46 @@ void setMultiPV(unsigned int n) {
     multiPV = n;
 }
 
+// Creates the memory and the pool thread for the next thread ID
+static void addSearchThread() {
+    ThreadMemory *memory = new ThreadMemory(evalCacheSize);
+    memory->thread = std::thread(searchThreadLoop, memory, (int) threadMemoryArray.size());
+    threadMemoryArray.push_back(memory);
+}
+
+// Joins the pool thread with the highest thread ID and frees its memory.
+// The thread must be idle.
+static void removeSearchThread() {
+    ThreadMemory *memory = threadMemoryArray.back();
+    {
+        std::lock_guard<std::mutex> lock(threadPoolMutex);
+        memory->exiting = true;
+    }
+    threadPoolCV.notify_all();
+    memory->thread.join();
+    delete memory;
+    threadMemoryArray.pop_back();
+}
+
+// Only called while no search is running
 void setNumThreads(int n) {
     numThreads = n;
+    transpositionTable.setClearThreads(n);
 
     while ((int) threadMemoryArray.size() < n)
-        threadMemoryArray.push_back(new ThreadMemory());
-    while ((int) threadMemoryArray.size() > n) {
-        delete threadMemoryArray.back();
-        threadMemoryArray.pop_back();
-    }
+        addSearchThread();
+    while ((int) threadMemoryArray.size() > n)
+        removeSearchThread();
 }
 
 void initPerThreadMemory() {
-    threadMemoryArray.push_back(new ThreadMemory());
+    addSearchThread();
+}
+
+// Joins all pool threads before the program exits
+void destroySearchThreads() {
+    while (!threadMemoryArray.empty())
+        removeSearchThread();
 }
 
 TwoFoldStack *getTwoFoldStackPointer() {
@@ -84,23 +84,37 @@ public:
 struct SearchStackInfo {
     int ply;
     int staticEval;
-    int **counterMoveHistory;
-    int **followupMoveHistory;
+    // Continuation histories of the previous move and of our own previous
+    // move, indexed by piece and end square
+    int16_t (*counterMoveHistory)[64];
+    int16_t (*followupMoveHistory)[64];
 };
 
 void getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *movesToSearch);
+void startSearch(const Board *b, TimeManagement *timeParams, MoveList *movesToSearch);
+void waitForSearch();
 void clearTables();
 void setHashSize(uint64_t MB);
+void printHashAllocation();
+void setEvalCacheSize(uint64_t KB);
+bool saveHash(const std::string &fileName);
+bool loadHash(const std::string &fileName);
+uint64_t getHashSize();
+void resetHashStatistics();
+void printHashStatistics();
 uint64_t getNodes();
 void setMultiPV(unsigned int n);
 void setNumThreads(int n);
 void initPerThreadMemory();
+void destroySearchThreads();
 void initReductionTable();
 TwoFoldStack *getTwoFoldStackPointer();
 
 // Pondering
 void startPonder();
 void stopPonder();
+void stopSearch();
+void setDebugMode(bool on);
 
 // Time constants
 constexpr uint64_t ONE_SECOND = 1000;
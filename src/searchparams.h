@@ -19,57 +19,48 @@
 #ifndef __SEARCHPARAMS_H__
 #define __SEARCHPARAMS_H__
 
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include "common.h"
 
+// History of a move indexed by piece and end square. The continuation
+// histories hold one of these for each piece and end square of an earlier
+// move. Entries stay within +-448 through the gravity update, so 16 bits
+// are enough.
+typedef int16_t PieceToHistory[6][64];
+
 struct SearchParameters {
     int ply;
     int selectiveDepth;
     Move killers[MAX_DEPTH+1][2];
     int historyTable[2][6][64];
     int captureHistory[2][6][6][64];
-    int **counterMoveHistory[6][64];
-    int **followupMoveHistory[6][64];
+    // Both continuation histories are in one cache line aligned block
+    PieceToHistory (*counterMoveHistory)[64];
+    PieceToHistory (*followupMoveHistory)[64];
+    // The memory block returned by the allocator, which may not be aligned
+    void *continuationHistoryMem;
 
     SearchParameters() {
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                counterMoveHistory[i][j] = new int *[6];
-                for (int k = 0; k < 6; k++) {
-                    counterMoveHistory[i][j][k] = new int[64];
-                }
-            }
-        }
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                followupMoveHistory[i][j] = new int *[6];
-                for (int k = 0; k < 6; k++) {
-                    followupMoveHistory[i][j][k] = new int[64];
-                }
-            }
-        }
+        constexpr size_t TABLE_SIZE = sizeof(PieceToHistory[6][64]);
+        // Over-allocate by one cache line so that the tables can be aligned
+        continuationHistoryMem = calloc(2 * TABLE_SIZE + 64, 1);
+        uintptr_t alignedAddress = ((uintptr_t) continuationHistoryMem + 63) & ~((uintptr_t) 63);
+        counterMoveHistory = (PieceToHistory (*)[64]) alignedAddress;
+        followupMoveHistory = (PieceToHistory (*)[64]) (alignedAddress + TABLE_SIZE);
+
         reset();
         resetHistoryTable();
     }
 
     ~SearchParameters() {
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                for (int k = 0; k < 6; k++) {
-                    delete[] counterMoveHistory[i][j][k];
-                }
-                delete[] counterMoveHistory[i][j];
-            }
-        }
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                for (int k = 0; k < 6; k++) {
-                    delete[] followupMoveHistory[i][j][k];
-                }
-                delete[] followupMoveHistory[i][j];
-            }
-        }
+        free(continuationHistoryMem);
     }
 
+    SearchParameters(const SearchParameters &other) = delete;
+    SearchParameters& operator=(const SearchParameters &other) = delete;
+
     void reset() {
         ply = 0;
         for (int i = 0; i < MAX_DEPTH; i++) {
@@ -95,23 +86,8 @@ struct SearchParameters {
             }
         }
 
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                for (int k = 0; k < 6; k++) {
-                    for (int l = 0; l < 64; l++)
-                        counterMoveHistory[i][j][k][l] = 0;
-                }
-            }
-        }
-
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                for (int k = 0; k < 6; k++) {
-                    for (int l = 0; l < 64; l++)
-                        followupMoveHistory[i][j][k][l] = 0;
-                }
-            }
-        }
+        std::memset(counterMoveHistory, 0, sizeof(PieceToHistory[6][64]));
+        std::memset(followupMoveHistory, 0, sizeof(PieceToHistory[6][64]));
     }
 };
 
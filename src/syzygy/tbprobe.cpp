@@ -36,7 +36,7 @@
 #include "tbprobe.h"
 #include "tbcore.h"
 
-extern uint64_t zobristTable[794];
+extern const uint64_t zobristTable[794];
 
 // int TBlargest = 0;
 
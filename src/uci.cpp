@@ -20,6 +20,7 @@
 #include <atomic>
 #include <cmath>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <vector>
@@ -30,6 +31,7 @@
 #include "bbinit.h"
 #include "board.h"
 #include "eval.h"
+#include "hash.h"
 #include "search.h"
 #include "timeman.h"
 #include "uci.h"
@@ -41,6 +43,8 @@ using std::endl;
 using std::string;
 
 constexpr char STARTPOS[] = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+// Size in MB of the table shared by the perft threads
+constexpr uint64_t PERFT_HASH_SIZE = 64;
 
 void setPosition(string &input, std::vector<string> &inputVector, Board &board);
 std::vector<string> split(const string &s, char d);
@@ -49,7 +53,11 @@ string boardToString(Board &board);
 bool equalsIgnoreCase(const std::string &s1, const std::string &s2);
 void stringToLowerCase(std::string &s);
 void clearAll(Board &board);
-uint64_t perft(Board &b, int color, int depth, uint64_t &captures);
+uint64_t perft(Board &b, int color, int depth, PerftHash &perftHash);
+uint64_t perftPseudoLegal(Board &b, int color, int depth);
+PerftHash &getPerftHash();
+uint64_t perftRoot(Board &b, int depth, bool divide, PerftHash &perftHash);
+void runPerftSuite(const string &fileName, int maxDepth);
 void runBenchmark(Board &b, int depth);
 
 
@@ -59,14 +67,13 @@ TimeManagement timeParams;
 // Declared in search.cpp
 extern std::atomic<bool> isStop;
 extern std::atomic<bool> stopSignal;
+extern int numThreads;
 
 
 int main(int argc, char **argv) {
-    initMagicTables(2563762638929852183ULL);
-    initEvalTables();
-    initDistances();
-    initZobristTable();
-    initInBetweenTable();
+    initCpuFeatures();
+    initMagicTables();
+    initStartPosKeys();
     initPerThreadMemory();
     initReductionTable();
 
@@ -78,7 +85,6 @@ int main(int argc, char **argv) {
     string name = "Laser";
     string version = "1.8 beta";
     string author = "Jeffrey An and Michael An";
-    std::thread searchThread;
 
     Board board = fenToBoard(STARTPOS);
 
@@ -87,10 +93,13 @@ int main(int argc, char **argv) {
     // Run benchmark from command line with given depth
     if (argc > 1 && strcmp(argv[1], "bench") == 0) {
         runBenchmark(board, argc > 2 ? atoi(argv[2]) : 0);
+        destroySearchThreads();
         return 0;
     }
 
     while (getline(std::cin, input)) {
+        // File names are case sensitive, so keep a copy of the original input
+        string rawInput = input;
         stringToLowerCase(input);
         inputVector = split(input, ' ');
         std::cin.clear();
@@ -98,6 +107,11 @@ int main(int argc, char **argv) {
         // Ignore all input other than "stop", "quit", and "ponderhit" while running a search.
         if (!isStop && input != "stop" && input != "quit" && input != "ponderhit")
             continue;
+        // After bestmove, the search may still be waiting for its helper
+        // threads to see the stop signal. Let it finish before any other
+        // command changes the position, options, or stop flags.
+        if (input != "stop" && input != "quit" && input != "ponderhit")
+            waitForSearch();
 
         if (input == "uci") {
             cout << "id name " << name << " " << version << endl;
@@ -106,6 +120,8 @@ int main(int argc, char **argv) {
                  << " min " << MIN_THREADS << " max " << MAX_THREADS << endl;
             cout << "option name Hash type spin default " << DEFAULT_HASH_SIZE
                  << " min " << MIN_HASH_SIZE << " max " << MAX_HASH_SIZE << endl;
+            cout << "option name EvalCache type spin default " << DEFAULT_EVAL_CACHE_SIZE
+                 << " min " << MIN_EVAL_CACHE_SIZE << " max " << MAX_EVAL_CACHE_SIZE << endl;
             cout << "option name Ponder type check default false" << endl;
             cout << "option name MultiPV type spin default " << DEFAULT_MULTI_PV
                  << " min " << MIN_MULTI_PV << " max " << MAX_MULTI_PV << endl;
@@ -117,9 +133,14 @@ int main(int argc, char **argv) {
             cout << "option name ScaleKingSafety type spin default " << DEFAULT_EVAL_SCALE
                  << " min " << MIN_EVAL_SCALE << " max " << MAX_EVAL_SCALE << endl;
             cout << "uciok" << endl;
+            // The default table is allocated before any Hash option is set
+            printHashAllocation();
         }
         else if (input == "isready") cout << "readyok" << endl;
-        else if (input == "ucinewgame") clearAll(board);
+        else if (input == "ucinewgame") {
+            clearAll(board);
+            resetHashStatistics();
+        }
         else if (input.substr(0, 8) == "position") setPosition(input, inputVector, board);
         else if (input.substr(0, 2) == "go" && isStop) {
             std::vector<string>::iterator it;
@@ -206,26 +227,21 @@ int main(int argc, char **argv) {
 
             isStop = false;
             stopSignal = false;
-            if (searchThread.joinable()) searchThread.join();
-            searchThread = std::thread(getBestMoveThreader, &board, &timeParams, &movesToSearch);
+            startSearch(&board, &timeParams, &movesToSearch);
         }
         else if (input == "ponderhit") {
             stopPonder();
         }
 
         else if (input == "stop") {
-            stopPonder();
-            isStop = true;
-            stopSignal = true;
-            if (searchThread.joinable()) searchThread.join();
+            stopSearch();
+            waitForSearch();
         }
         else if (input == "quit") {
-            stopPonder();
-            isStop = true;
-            stopSignal = true;
-            if (searchThread.joinable()) searchThread.join();
             break;
         }
+        else if (input == "debug on") setDebugMode(true);
+        else if (input == "debug off") setDebugMode(false);
         else if (input.substr(0, 9) == "setoption" && inputVector.size() >= 5) {
             if (inputVector.at(1) != "name" || inputVector.at(3) != "value") {
                 cout << "info string Invalid option format." << endl;
@@ -247,6 +263,14 @@ int main(int argc, char **argv) {
                         MB = MAX_HASH_SIZE;
                     setHashSize(MB);
                 }
+                else if (inputVector.at(2) == "evalcache") {
+                    uint64_t KB = std::stoull(inputVector.at(4));
+                    if (KB < MIN_EVAL_CACHE_SIZE)
+                        KB = MIN_EVAL_CACHE_SIZE;
+                    if (KB > MAX_EVAL_CACHE_SIZE)
+                        KB = MAX_EVAL_CACHE_SIZE;
+                    setEvalCacheSize(KB);
+                }
                 else if (inputVector.at(2) == "ponder") {
                     // do nothing
                 }
@@ -298,21 +322,64 @@ int main(int argc, char **argv) {
 
         //----------------------------Non-UCI Commands--------------------------
         else if (input == "board") cerr << boardToString(board);
-        else if (input.substr(0, 5) == "perft" && inputVector.size() == 2) {
-            int depth = std::stoi(inputVector.at(1));
-
-            uint64_t captures = 0;
-            auto startTime = ChessClock::now();
-
-            uint64_t nodes = perft(board, board.getPlayerToMove(), depth, captures);
-
-            uint64_t time = getTimeElapsed(startTime);
-
-            cerr << "Nodes: " << nodes << endl;
-            cerr << "Captures: " << captures << endl;
-            cerr << "Time: " << time << endl;
-            cerr << "Nodes/second: " << 1000 * nodes / time << endl;
+        // perft <depth> [pseudo]
+        // perft divide <depth>
+        // perft suite <file> [max depth]
+        else if (input.substr(0, 5) == "perft" && inputVector.size() >= 2) {
+            if (inputVector.at(1) == "suite" && inputVector.size() >= 3) {
+                std::vector<string> rawVector = split(rawInput, ' ');
+                int maxDepth = (inputVector.size() >= 4) ? std::stoi(inputVector.at(3)) : MAX_DEPTH;
+                runPerftSuite(rawVector.at(2), maxDepth);
+            }
+            else if (inputVector.at(1) == "divide" && inputVector.size() >= 3) {
+                int depth = std::stoi(inputVector.at(2));
+                PerftHash &perftHash = getPerftHash();
+                perftHash.clear();
+                auto startTime = ChessClock::now();
+                uint64_t nodes = perftRoot(board, depth, true, perftHash);
+                uint64_t time = std::max(getTimeElapsed(startTime), (uint64_t) 1);
+
+                cerr << "Nodes: " << nodes << endl;
+                cerr << "Time: " << time << endl;
+                cerr << "Nodes/second: " << 1000 * nodes / time << endl;
+            }
+            else {
+                int depth = std::stoi(inputVector.at(1));
+                // "perft <depth> pseudo" makes every pseudo-legal move on a
+                // single thread, without hashing or bulk counting, as a
+                // reference for the legal move generator
+                bool pseudo = (inputVector.size() >= 3 && inputVector.at(2) == "pseudo");
+                PerftHash &perftHash = getPerftHash();
+                if (!pseudo)
+                    perftHash.clear();
+
+                auto startTime = ChessClock::now();
+                uint64_t nodes = pseudo ? perftPseudoLegal(board, board.getPlayerToMove(), depth)
+                                        : perftRoot(board, depth, false, perftHash);
+                uint64_t time = std::max(getTimeElapsed(startTime), (uint64_t) 1);
+
+                cerr << "Nodes: " << nodes << endl;
+                cerr << "Time: " << time << endl;
+                cerr << "Nodes/second: " << 1000 * nodes / time << endl;
+            }
         }
+        else if ((input.substr(0, 9) == "savehash " || input.substr(0, 9) == "loadhash ")
+              && rawInput.find_first_not_of(' ', 9) != string::npos) {
+            string fileName = rawInput.substr(rawInput.find_first_not_of(' ', 9));
+            if (input.substr(0, 8) == "savehash") {
+                if (saveHash(fileName))
+                    cout << "info string Saved hash to " << fileName << endl;
+                else
+                    cout << "info string Could not save hash to " << fileName << endl;
+            }
+            else {
+                if (loadHash(fileName))
+                    cout << "info string Loaded " << getHashSize() << " hash entries from " << fileName << endl;
+                else
+                    cout << "info string Could not load hash from " << fileName << endl;
+            }
+        }
+        else if (input == "hashstats") printHashStatistics();
         else if (input.substr(0, 5) == "bench") {
             int depth = 0;
             if (inputVector.size() == 2)
@@ -328,6 +395,11 @@ int main(int argc, char **argv) {
         // According to UCI protocol, inputs that do not make sense are ignored
     }
 
+    // Stop any search still running on quit or at the end of input
+    stopSearch();
+    waitForSearch();
+    destroySearchThreads();
+
     return 0;
 }
 
@@ -458,7 +530,7 @@ Board fenToBoard(string s) {
 }
 
 string boardToFEN(Board &board) {
-    int *mailbox = board.getMailbox();
+    const int8_t *mailbox = board.getMailbox();
     string pieceString = "PNBRQKpnbrqk";
     string fenString;
     int emptyCt = 0;
@@ -513,7 +585,7 @@ string boardToFEN(Board &board) {
 }
 
 string boardToString(Board &board) {
-    int *mailbox = board.getMailbox();
+    const int8_t *mailbox = board.getMailbox();
     string pieceString = " PNBRQKpnbrqk";
     string boardString;
     for (int i = 7; i >= 0; i--) {
@@ -525,7 +597,6 @@ string boardToString(Board &board) {
         boardString += "|\n";
     }
     boardString += "  abcdefgh\n";
-    delete[] mailbox;
     return boardString;
 }
 
@@ -580,7 +651,35 @@ void clearAll(Board &board) {
  * 8/8/15: PERFT 6, 5.90 s (i5-5200u)
  * 8/11/15: PERFT 6, 5.20 s (i5-5200u)
  */
-uint64_t perft(Board &b, int color, int depth, uint64_t &captures) {
+uint64_t perft(Board &b, int color, int depth, PerftHash &perftHash) {
+    if (depth == 0)
+        return 1;
+
+    MoveList pl;
+    // Bulk counting: every legal move at the last ply is exactly one leaf
+    if (depth == 1) {
+        b.getLegalMoves(pl, color);
+        return pl.size();
+    }
+
+    // Probe before generating moves so that hash hits skip move generation
+    uint64_t nodes = 0;
+    if (perftHash.get(b.getZobristKey(), depth, nodes))
+        return nodes;
+
+    b.getLegalMoves(pl, color);
+    for (unsigned int i = 0; i < pl.size(); i++) {
+        UndoInfo undo;
+        b.doMove(pl.get(i), color, undo);
+        nodes += perft(b, color^1, depth-1, perftHash);
+        b.undoMove(pl.get(i), undo);
+    }
+
+    perftHash.add(b.getZobristKey(), depth, nodes);
+    return nodes;
+}
+
+uint64_t perftPseudoLegal(Board &b, int color, int depth) {
     if (depth == 0)
         return 1;
 
@@ -589,19 +688,137 @@ uint64_t perft(Board &b, int color, int depth, uint64_t &captures) {
     MoveList pl;
     b.getAllPseudoLegalMoves(pl, color);
     for (unsigned int i = 0; i < pl.size(); i++) {
-        Board copy = b.staticCopy();
-        if (!copy.doPseudoLegalMove(pl.get(i), color))
+        UndoInfo undo;
+        if (!b.doPseudoLegalMove(pl.get(i), color, undo))
             continue;
 
-        if (isCapture(pl.get(i)))
-            captures++;
-
-        nodes += perft(copy, color^1, depth-1, captures);
+        nodes += perftPseudoLegal(b, color^1, depth-1);
+        b.undoMove(pl.get(i), undo);
     }
 
     return nodes;
 }
 
+// The perft transposition table, allocated on first use. Callers clear it
+// before each timed run so that the reported speed measures move generation
+// rather than hits left over from an earlier run.
+PerftHash &getPerftHash() {
+    static PerftHash perftHash(PERFT_HASH_SIZE);
+    return perftHash;
+}
+
+// Splits the root moves among the search threads, which take the next
+// unclaimed move from a shared counter. With divide, the count below each
+// root move is printed in move generation order.
+uint64_t perftRoot(Board &b, int depth, bool divide, PerftHash &perftHash) {
+    if (depth <= 0)
+        return 1;
+
+    int color = b.getPlayerToMove();
+    MoveList rootMoves;
+    b.getLegalMoves(rootMoves, color);
+
+    std::vector<uint64_t> moveNodes(rootMoves.size(), 0);
+    std::atomic<unsigned int> nextMove(0);
+    auto perftWorker = [&]() {
+        Board copy = b.staticCopy();
+        for (unsigned int i = nextMove++; i < rootMoves.size(); i = nextMove++) {
+            UndoInfo undo;
+            copy.doMove(rootMoves.get(i), color, undo);
+            moveNodes[i] = perft(copy, color^1, depth-1, perftHash);
+            copy.undoMove(rootMoves.get(i), undo);
+        }
+    };
+
+    // Perft uses its own short-lived threads, since the search pool threads
+    // only run getBestMove, and thread creation is negligible next to a perft
+    std::vector<std::thread> threadPool;
+    for (int i = 1; i < numThreads; i++)
+        threadPool.push_back(std::thread(perftWorker));
+    perftWorker();
+    for (unsigned int i = 0; i < threadPool.size(); i++)
+        threadPool[i].join();
+
+    uint64_t nodes = 0;
+    for (unsigned int i = 0; i < rootMoves.size(); i++) {
+        if (divide)
+            cerr << moveToString(rootMoves.get(i)) << ": " << moveNodes[i] << endl;
+        nodes += moveNodes[i];
+    }
+    return nodes;
+}
+
+/*
+ * Runs perft on every position in a suite file and compares the results with
+ * the expected counts. Each line holds a FEN followed by the expected counts,
+ * in the common EPD perft format:
+ *   <fen> ;D1 <nodes> ;D2 <nodes> ...
+ * Depths above maxDepth are skipped.
+ */
+void runPerftSuite(const string &fileName, int maxDepth) {
+    std::ifstream suiteFile(fileName);
+    if (!suiteFile.is_open()) {
+        cerr << "Could not open perft suite " << fileName << endl;
+        return;
+    }
+
+    int positions = 0, passed = 0, failed = 0;
+    uint64_t totalNodes = 0;
+    // Only the perft runs are timed, each starting from an empty hash
+    ChessClock::duration perftTime = ChessClock::duration::zero();
+    PerftHash &perftHash = getPerftHash();
+
+    string line;
+    while (getline(suiteFile, line)) {
+        std::vector<string> fields = split(line, ';');
+        if (fields.size() < 2)
+            continue;
+
+        string fen = fields.at(0);
+        fen.erase(fen.find_last_not_of(" \t\r") + 1);
+        Board b = fenToBoard(fen);
+        positions++;
+        cerr << "Position " << positions << ": " << fen << endl;
+
+        for (unsigned int i = 1; i < fields.size(); i++) {
+            std::istringstream field(fields.at(i));
+            string depthStr;
+            uint64_t expected;
+            if (!(field >> depthStr >> expected) || depthStr.size() < 2
+             || (depthStr.at(0) != 'D' && depthStr.at(0) != 'd'))
+                continue;
+            int depth = std::stoi(depthStr.substr(1));
+            if (depth > maxDepth)
+                continue;
+
+            perftHash.clear();
+            auto startTime = ChessClock::now();
+            uint64_t nodes = perftRoot(b, depth, false, perftHash);
+            perftTime += ChessClock::now() - startTime;
+            totalNodes += nodes;
+            bool pass = (nodes == expected);
+            if (pass)
+                passed++;
+            else
+                failed++;
+            cerr << "  depth " << depth << ": " << nodes;
+            if (pass)
+                cerr << " pass" << endl;
+            else
+                cerr << " FAIL (expected " << expected << ")" << endl;
+        }
+    }
+
+    uint64_t time = std::max((uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(
+        perftTime).count(), (uint64_t) 1);
+    cerr << "Positions: " << positions << endl;
+    cerr << "Passed: " << passed << endl;
+    cerr << "Failed: " << failed << endl;
+    cerr << "Nodes: " << totalNodes << endl;
+    cerr << "Time: " << time << endl;
+    cerr << "Nodes/second: " << 1000 * totalNodes / time << endl;
+}
+
 void runBenchmark(Board &b, int depth) {
     const std::vector<string> benchPositions = {
         "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -",
@@ -627,6 +844,7 @@ void runBenchmark(Board &b, int depth) {
     timeParams.searchMode = DEPTH;
     // Set a default when the given depth is 0.
     timeParams.allotment = depth ? depth : 13;
+    resetHashStatistics();
 
     for (unsigned int i = 0; i < benchPositions.size(); i++) {
         clearAll(b);
@@ -643,9 +861,10 @@ void runBenchmark(Board &b, int depth) {
 
     uint64_t time = getTimeElapsed(startTime);
 
-    clearAll(b);
-
     cerr << "Time  : " << time << " ms" << endl;
     cerr << "Nodes : " << totalNodes << endl;
     cerr << "NPS   : " << 1000 * totalNodes / time << endl;
+    printHashStatistics();
+
+    clearAll(b);
 }
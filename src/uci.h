@@ -25,6 +25,9 @@
 constexpr uint64_t DEFAULT_HASH_SIZE = 16;
 constexpr uint64_t MIN_HASH_SIZE = 1;
 constexpr uint64_t MAX_HASH_SIZE = 1024 * 1024;
+constexpr uint64_t DEFAULT_EVAL_CACHE_SIZE = 256;
+constexpr uint64_t MIN_EVAL_CACHE_SIZE = 16;
+constexpr uint64_t MAX_EVAL_CACHE_SIZE = 64 * 1024;
 constexpr int DEFAULT_MULTI_PV = 1;
 constexpr int MIN_MULTI_PV = 1;
 constexpr int MAX_MULTI_PV = 256;